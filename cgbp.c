@@ -14,9 +14,11 @@
 #include <unistd.h>
 
 #include "cgbp.h"
+#include "kernel.h"
 
 #define CGBP_BACKEND_PATH_LEN (sizeof CGBP_BACKEND_PATH - 1)
 #define CGBP_FPS 30
+#define CGBP_PROBE_FRAMES 16
 
 static inline struct timespec timespec_add(const struct timespec ts1,
                                            const struct timespec ts2) {
@@ -44,11 +46,133 @@ static inline struct timespec timespec_add(const struct timespec ts1,
 #define timespec_double(ts) \
 	((double)(ts).tv_sec + (double)(ts).tv_nsec / 1e9)
 
+extern struct cgbp_driver xlib_shm_driver, xlib_driver, drm_driver,
+                          fbdev_driver, headless_driver;
+
+struct cgbp_driver driver;
+
+// candidates for probing; headless is the fallback if none of them work
+static struct cgbp_driver *const cgbp_drivers[] = {
+	&xlib_shm_driver,
+	&xlib_driver,
+	&drm_driver,
+	&fbdev_driver,
+};
+
+static inline int cgbp_format_ok(struct cgbp *c) {
+#ifdef CGBP_FIXED_FORMAT
+	if(c->fb.format != CGBP_FIXED_FORMAT || c->fb.data == NULL) {
+		fprintf(stderr, "Error: %s: unsupported pixel format.\n", driver.name);
+		return 0;
+	}
+#endif
+	return 1;
+	(void)c;
+}
+
+// presents per second with an empty frame, or -1 if d doesn't work here
+static inline double cgbp_probe(struct cgbp *c, struct cgbp_driver *d) {
+	struct timespec start, end;
+	size_t i;
+	driver = *d;
+	c->driver_data = NULL;
+	c->fb = (struct cgbp_fb){ c, NULL, 0, 0, 0, CGBP_FORMAT_UNKNOWN };
+	if(driver.init(c) < 0) {
+		c->driver_data = NULL;
+		return -1;
+	}
+	if(!cgbp_format_ok(c)) {
+		i = 0;
+		goto done;
+	}
+	if(clock_gettime(CLOCK_MONOTONIC, &start) < 0) {
+		perror("clock_gettime");
+		i = 0;
+		goto done;
+	}
+	for(i = 0; i < CGBP_PROBE_FRAMES; i++)
+		if(driver.update(c, NULL, (struct cgbp_callbacks){ NULL, NULL }) < 0)
+			break;
+	if(clock_gettime(CLOCK_MONOTONIC, &end) < 0) {
+		perror("clock_gettime");
+		i = 0;
+	}
+done:
+	driver.cleanup(c);
+	c->driver_data = NULL;
+	if(i < CGBP_PROBE_FRAMES)
+		return -1;
+	return CGBP_PROBE_FRAMES / timespec_double(timespec_diff(end, start));
+}
+
+static inline int cgbp_select_driver(struct cgbp *c) {
+	const char *name = getenv("CGBP_DRIVER");
+	struct cgbp_driver *best = &headless_driver;
+	double rate, best_rate = 0;
+	size_t i;
+	if(name != NULL) {
+		for(i = 0; i < sizeof cgbp_drivers / sizeof *cgbp_drivers; i++)
+			if(strcmp(name, cgbp_drivers[i]->name) == 0) {
+				best = cgbp_drivers[i];
+				goto done;
+			}
+		if(strcmp(name, headless_driver.name) == 0)
+			goto done;
+		fprintf(stderr, "Error: CGBP_DRIVER: unknown driver \"%s\".\n", name);
+		return -1;
+	}
+	/* drm and xshm wait for the display, so they're never the fastest;
+	 * any rate that keeps up with the frame timer is as good as the next,
+	 * and the first in the list wins. below that, the fastest does */
+	for(i = 0; i < sizeof cgbp_drivers / sizeof *cgbp_drivers; i++) {
+		rate = cgbp_probe(c, cgbp_drivers[i]);
+		if(rate < 0) {
+			fprintf(stderr, "probe %s: unavailable\n", cgbp_drivers[i]->name);
+			continue;
+		}
+		fprintf(stderr, "probe %s: %.1f presents/s\n",
+		        cgbp_drivers[i]->name, rate);
+		if(rate > best_rate) {
+			best = cgbp_drivers[i];
+			best_rate = rate;
+		}
+		if(best_rate >= CGBP_FPS)
+			break;
+	}
+	if(best == &headless_driver)
+		fprintf(stderr, "probe: no driver works, falling back\n");
+	else if(best_rate >= CGBP_FPS)
+		fprintf(stderr, "probe: %s is the first to keep up with %d fps\n",
+		        best->name, CGBP_FPS);
+	else
+		fprintf(stderr, "probe: %s is the fastest, none keep up with %d "
+		        "fps\n", best->name, CGBP_FPS);
+done:
+	driver = *best;
+	fprintf(stderr, "driver: %s\n", driver.name);
+	return 0;
+}
+
 int cgbp_init(struct cgbp *c) {
 	c->driver_data = NULL;
 	c->timer_set = 0;
 	c->running = 1;
-	if(driver.init != NULL && driver.init(c) < 0) {
+	if(clock_gettime(CLOCK_MONOTONIC, &c->start_time) < 0) {
+		perror("clock_gettime");
+		return -1;
+	}
+	c->total_frametime = (struct timespec){ 0, 0 };
+	c->num_frames = 0;
+	if(cgbp_kernels_init() < 0 || cgbp_select_driver(c) < 0)
+		return -1;
+	c->fb = (struct cgbp_fb){ c, NULL, 0, 0, 0, CGBP_FORMAT_UNKNOWN };
+	if(driver.init(c) < 0) {
+		// drivers clean up after themselves when init fails
+		c->driver_data = NULL;
+		cgbp_cleanup(c);
+		return -1;
+	}
+	if(!cgbp_format_ok(c)) {
 		cgbp_cleanup(c);
 		return -1;
 	}
@@ -59,12 +183,11 @@ int cgbp_init(struct cgbp *c) {
 		return -1;
 	}
 	c->timer_set = 1;
+	// don't count probing towards the runtime
 	if(clock_gettime(CLOCK_MONOTONIC, &c->start_time) < 0) {
 		perror("clock_gettime");
 		return -1;
 	}
-	c->total_frametime = (struct timespec){ 0, 0 };
-	c->num_frames = 0;
 	return 0;
 }
 
@@ -118,6 +241,18 @@ int cgbp_main(struct cgbp *c, void *data, struct cgbp_callbacks cb) {
 	return 0;
 }
 
+int cgbp_key_pressed(struct cgbp *c, char key) {
+	if(driver.key_pressed == NULL || c->driver_data == NULL)
+		return -1;
+	return driver.key_pressed(c, key);
+}
+
+double cgbp_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return timespec_double(ts);
+}
+
 void cgbp_cleanup(struct cgbp *c) {
 	struct timespec ts;
 	double runtime;
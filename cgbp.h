@@ -19,22 +19,42 @@ struct cgbp_size {
 	size_t w, h;
 };
 
+enum cgbp_format {
+	CGBP_FORMAT_UNKNOWN,
+	CGBP_FORMAT_XRGB8888,
+	CGBP_FORMAT_ARGB8888, // alpha is forced opaque
+	CGBP_FORMAT_RGB888,
+	CGBP_FORMAT_RGB565,
+};
+
+/* the framebuffer as published by the driver at init. with
+ * CGBP_FORMAT_UNKNOWN, pixels go through driver.get_pixel/set_pixel. */
+struct cgbp_fb {
+	struct cgbp *c;
+	uint8_t *data;
+	size_t w, h, stride;
+	enum cgbp_format format;
+};
+
 struct cgbp_callbacks {
 	int (*update)(struct cgbp*, void*);
 	int (*action)(struct cgbp*, void*, char);
 };
 
 extern struct cgbp_driver {
+	const char *name;
 	int (*init)(struct cgbp*);
 	int (*update)(struct cgbp*, void*, struct cgbp_callbacks);
 	void (*cleanup)(struct cgbp*);
 	uint32_t (*get_pixel)(struct cgbp*, size_t, size_t);
 	void (*set_pixel)(struct cgbp*, size_t, size_t, uint32_t);
 	struct cgbp_size (*size)(struct cgbp*);
+	int (*key_pressed)(struct cgbp*, char);
 } driver;
 
 struct cgbp {
 	struct timespec start_time, total_frametime;
+	struct cgbp_fb fb;
 	void *driver_data;
 	timer_t timerid;
 	size_t num_frames;
@@ -45,4 +65,93 @@ int cgbp_init(struct cgbp *c);
 int cgbp_main(struct cgbp *c, void *data, struct cgbp_callbacks cb);
 void cgbp_cleanup(struct cgbp *c);
 
+// 1 if the key is currently held, 0 if not, -1 if the driver can't tell
+int cgbp_key_pressed(struct cgbp *c, char key);
+
+// monotonic seconds, for benchmarks
+double cgbp_time(void);
+
+/* per-format pixel accessors on a framebuffer row. colors are 0xRRGGBB.
+ * x is not bounds checked. */
+#define CGBP_DEFINE_FORMAT(name, bytes_pp, load, store) \
+	static inline uint32_t cgbp_get_##name(const uint8_t *row, size_t x) { \
+		const uint8_t *p = row + x * (bytes_pp); \
+		return load; \
+	} \
+	static inline void cgbp_set_##name(uint8_t *row, size_t x, uint32_t v) { \
+		uint8_t *p = row + x * (bytes_pp); \
+		store; \
+	}
+
+CGBP_DEFINE_FORMAT(xrgb8888, 4,
+	*(const uint32_t*)p & 0xffffff,
+	*(uint32_t*)p = v)
+CGBP_DEFINE_FORMAT(argb8888, 4,
+	*(const uint32_t*)p & 0xffffff,
+	*(uint32_t*)p = 0xff000000 | v)
+CGBP_DEFINE_FORMAT(rgb888, 3,
+	(uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16,
+	(p[0] = v, p[1] = v >> 8, p[2] = v >> 16))
+CGBP_DEFINE_FORMAT(rgb565, 2,
+	((*(const uint16_t*)p & 0xf800) << 8 | (*(const uint16_t*)p & 0xe000) << 3 |
+	 (*(const uint16_t*)p & 0x07e0) << 5 | (*(const uint16_t*)p & 0x0600) >> 1 |
+	 (*(const uint16_t*)p & 0x001f) << 3 | (*(const uint16_t*)p & 0x001c) >> 2),
+	*(uint16_t*)p = (v >> 8 & 0xf800) | (v >> 5 & 0x07e0) | (v >> 3 & 0x001f))
+
+/* building with -DCGBP_FIXED_FORMAT=CGBP_FORMAT_XRGB8888 (etc.) turns the
+ * format dispatch below into plain loads and stores; cgbp_init then refuses
+ * drivers publishing anything else. */
+#ifdef CGBP_FIXED_FORMAT
+#define CGBP_FB_FORMAT(fb) (CGBP_FIXED_FORMAT)
+#else
+#define CGBP_FB_FORMAT(fb) ((fb)->format)
+#endif
+
+static inline uint8_t *cgbp_fb_row(const struct cgbp_fb *fb, size_t y) {
+	return fb->data + y * fb->stride;
+}
+
+static inline uint32_t cgbp_fb_get_pixel(const struct cgbp_fb *fb,
+                                         size_t x, size_t y) {
+	switch(CGBP_FB_FORMAT(fb)) {
+	case CGBP_FORMAT_XRGB8888:
+		return cgbp_get_xrgb8888(cgbp_fb_row(fb, y), x);
+	case CGBP_FORMAT_ARGB8888:
+		return cgbp_get_argb8888(cgbp_fb_row(fb, y), x);
+	case CGBP_FORMAT_RGB888:
+		return cgbp_get_rgb888(cgbp_fb_row(fb, y), x);
+	case CGBP_FORMAT_RGB565:
+		return cgbp_get_rgb565(cgbp_fb_row(fb, y), x);
+	default:
+		return driver.get_pixel(fb->c, x, y);
+	}
+}
+
+static inline void cgbp_fb_set_pixel(const struct cgbp_fb *fb,
+                                     size_t x, size_t y, uint32_t color) {
+	switch(CGBP_FB_FORMAT(fb)) {
+	case CGBP_FORMAT_XRGB8888:
+		cgbp_set_xrgb8888(cgbp_fb_row(fb, y), x, color);
+		return;
+	case CGBP_FORMAT_ARGB8888:
+		cgbp_set_argb8888(cgbp_fb_row(fb, y), x, color);
+		return;
+	case CGBP_FORMAT_RGB888:
+		cgbp_set_rgb888(cgbp_fb_row(fb, y), x, color);
+		return;
+	case CGBP_FORMAT_RGB565:
+		cgbp_set_rgb565(cgbp_fb_row(fb, y), x, color);
+		return;
+	default:
+		driver.set_pixel(fb->c, x, y, color);
+		return;
+	}
+}
+
+/* hot loops should copy c->fb into a local first: stores into the
+ * framebuffer may otherwise alias it and defeat loop unswitching */
+#define cgbp_get_pixel(c, x, y) (cgbp_fb_get_pixel(&(c)->fb, (x), (y)))
+#define cgbp_set_pixel(c, x, y, color) \
+	(cgbp_fb_set_pixel(&(c)->fb, (x), (y), (color)))
+
 #endif // CGBP_H
@@ -0,0 +1,356 @@
+/* drm.c
+ *
+ * Copyright (c) 2018, mar77i <mar77i at protonmail dot ch>
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license.  See the LICENSE file for details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "cgbp.h"
+
+#define DRM_MAX_CARDS 8
+
+struct drm_buf {
+	uint32_t handle, pitch, fb_id;
+	uint64_t size;
+	uint8_t *map;
+};
+
+struct drm {
+	struct termios tc;
+	drmModeModeInfo mode;
+	drmModeCrtc *saved_crtc;
+	struct drm_buf bufs[2];
+	uint32_t conn_id, crtc_id;
+	int fd, old_fl;
+	uint8_t *data, front, tc_set: 1, flip_pending: 1;
+};
+
+static inline ssize_t drm_write_term(const char *str, size_t len) {
+	ssize_t ret;
+	if(len == 0)
+		len = strlen(str);
+	do {
+		errno = 0;
+		ret = write(STDOUT_FILENO, str, len);
+	} while(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+	return ret;
+}
+
+static inline uint32_t drm_find_crtc(int fd, drmModeRes *res,
+                                     drmModeConnector *conn) {
+	drmModeEncoder *enc;
+	uint32_t crtc_id = 0;
+	int i, j;
+	if(conn->encoder_id != 0) {
+		enc = drmModeGetEncoder(fd, conn->encoder_id);
+		if(enc != NULL) {
+			crtc_id = enc->crtc_id;
+			drmModeFreeEncoder(enc);
+			if(crtc_id != 0)
+				return crtc_id;
+		}
+	}
+	for(i = 0; i < conn->count_encoders; i++) {
+		enc = drmModeGetEncoder(fd, conn->encoders[i]);
+		if(enc == NULL)
+			continue;
+		for(j = 0; j < res->count_crtcs; j++)
+			if(enc->possible_crtcs & (1 << j)) {
+				crtc_id = res->crtcs[j];
+				break;
+			}
+		drmModeFreeEncoder(enc);
+		if(crtc_id != 0)
+			return crtc_id;
+	}
+	return 0;
+}
+
+// pick the first connected connector that has a mode and a usable crtc
+static inline int drm_setup_output(struct drm *d) {
+	drmModeRes *res = drmModeGetResources(d->fd);
+	drmModeConnector *conn;
+	int i, j;
+	if(res == NULL)
+		return -1;
+	for(i = 0; i < res->count_connectors; i++) {
+		conn = drmModeGetConnector(d->fd, res->connectors[i]);
+		if(conn == NULL)
+			continue;
+		if(conn->connection != DRM_MODE_CONNECTED || conn->count_modes == 0) {
+			drmModeFreeConnector(conn);
+			continue;
+		}
+		d->crtc_id = drm_find_crtc(d->fd, res, conn);
+		if(d->crtc_id == 0) {
+			drmModeFreeConnector(conn);
+			continue;
+		}
+		d->conn_id = conn->connector_id;
+		d->mode = conn->modes[0];
+		for(j = 0; j < conn->count_modes; j++)
+			if(conn->modes[j].type & DRM_MODE_TYPE_PREFERRED) {
+				d->mode = conn->modes[j];
+				break;
+			}
+		drmModeFreeConnector(conn);
+		drmModeFreeResources(res);
+		return 0;
+	}
+	drmModeFreeResources(res);
+	return -1;
+}
+
+static inline int drm_open(struct drm *d) {
+	char path[32];
+	int i;
+	for(i = 0; i < DRM_MAX_CARDS; i++) {
+		snprintf(path, sizeof path, "/dev/dri/card%d", i);
+		d->fd = open(path, O_RDWR|O_CLOEXEC);
+		if(d->fd < 0)
+			continue;
+		if(drm_setup_output(d) == 0)
+			return 0;
+		close(d->fd);
+	}
+	d->fd = -1;
+	fprintf(stderr, "Error: no DRM device with a connected output.\n");
+	return -1;
+}
+
+static inline int drm_create_buf(struct drm *d, struct drm_buf *b) {
+	struct drm_mode_create_dumb creq = {
+		.width = d->mode.hdisplay,
+		.height = d->mode.vdisplay,
+		.bpp = 32,
+	};
+	struct drm_mode_map_dumb mreq = { 0 };
+	if(drmIoctl(d->fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq) < 0) {
+		perror("DRM_IOCTL_MODE_CREATE_DUMB");
+		return -1;
+	}
+	b->handle = creq.handle;
+	b->pitch = creq.pitch;
+	b->size = creq.size;
+	if(drmModeAddFB(d->fd, creq.width, creq.height, 24, 32, b->pitch,
+	                b->handle, &b->fb_id) < 0) {
+		perror("drmModeAddFB");
+		return -1;
+	}
+	mreq.handle = b->handle;
+	if(drmIoctl(d->fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq) < 0) {
+		perror("DRM_IOCTL_MODE_MAP_DUMB");
+		return -1;
+	}
+	b->map = mmap(0, b->size, PROT_READ|PROT_WRITE, MAP_SHARED,
+	              d->fd, mreq.offset);
+	if(b->map == MAP_FAILED) {
+		perror("mmap");
+		b->map = NULL;
+		return -1;
+	}
+	memset(b->map, 0, b->size);
+	return 0;
+}
+
+static inline void drm_destroy_buf(struct drm *d, struct drm_buf *b) {
+	struct drm_mode_destroy_dumb dreq = { .handle = b->handle };
+	if(b->map != NULL)
+		munmap(b->map, b->size);
+	if(b->fb_id != 0)
+		drmModeRmFB(d->fd, b->fb_id);
+	if(b->handle != 0)
+		drmIoctl(d->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+}
+
+void drm_cleanup(struct cgbp *c);
+
+int drm_init(struct cgbp *c) {
+	struct drm *d = malloc(sizeof *d);
+	tcflag_t lflag_orig;
+	if(d == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	c->driver_data = d;
+	memset(d, 0, sizeof *d);
+	d->fd = -1;
+	d->old_fl = -1;
+
+	if(drm_open(d) < 0)
+		goto error;
+	d->saved_crtc = drmModeGetCrtc(d->fd, d->crtc_id);
+	if(drm_create_buf(d, &d->bufs[0]) < 0 ||
+	  drm_create_buf(d, &d->bufs[1]) < 0)
+		goto error;
+	if(drmModeSetCrtc(d->fd, d->crtc_id, d->bufs[0].fb_id, 0, 0,
+	                  &d->conn_id, 1, &d->mode) < 0) {
+		perror("drmModeSetCrtc");
+		goto error;
+	}
+	d->front = 0;
+
+	// draw into system memory; dumb buffers are slow to read back from
+	d->data = malloc(d->bufs[0].size);
+	if(d->data == NULL) {
+		perror("malloc");
+		goto error;
+	}
+	memset(d->data, 0, d->bufs[0].size);
+	c->fb.data = d->data;
+	c->fb.w = d->mode.hdisplay;
+	c->fb.h = d->mode.vdisplay;
+	c->fb.stride = d->bufs[0].pitch;
+	c->fb.format = CGBP_FORMAT_XRGB8888;
+
+	// turn off cursor
+	drm_write_term("\x1b[?25l", 6);
+	d->old_fl = fcntl(STDIN_FILENO, F_GETFL, 0);
+	if(fcntl(STDIN_FILENO, F_SETFL, d->old_fl|O_NONBLOCK) < 0) {
+		perror("fcntl");
+		goto error;
+	}
+	if(tcgetattr(STDIN_FILENO, &d->tc) < 0) {
+		perror("tcgetattr");
+		goto error;
+	}
+	d->tc_set = 1;
+	lflag_orig = d->tc.c_lflag;
+	d->tc.c_lflag &= ~(ICANON|ECHO);
+	if(tcsetattr(STDIN_FILENO, TCSANOW, &d->tc) < 0) {
+		perror("tcsetattr");
+		goto error;
+	}
+	d->tc.c_lflag = lflag_orig;
+	return 0;
+error:
+	drm_cleanup(c);
+	return -1;
+}
+
+static void drm_flip_done(int fd, unsigned int seq, unsigned int tv_sec,
+                          unsigned int tv_usec, void *user_data) {
+	struct drm *d = user_data;
+	d->flip_pending = 0;
+	(void)fd;
+	(void)seq;
+	(void)tv_sec;
+	(void)tv_usec;
+}
+
+// block until the previously queued flip has been latched at vblank
+static inline int drm_wait_flip(struct drm *d) {
+	drmEventContext ev = {
+		.version = 2,
+		.page_flip_handler = drm_flip_done,
+	};
+	struct pollfd pfd = { .fd = d->fd, .events = POLLIN };
+	while(d->flip_pending) {
+		if(poll(&pfd, 1, -1) < 0) {
+			if(errno == EINTR)
+				continue;
+			perror("poll");
+			return -1;
+		}
+		if(drmHandleEvent(d->fd, &ev) < 0) {
+			perror("drmHandleEvent");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int drm_update(struct cgbp *c, void *cb_data, struct cgbp_callbacks cb) {
+	struct drm *d = c->driver_data;
+	struct drm_buf *back = &d->bufs[!d->front];
+	char r;
+	if(cb.action != NULL) {
+		if(read(STDIN_FILENO, &r, 1) > 0 && cb.action(c, cb_data, r) < 0)
+			return -1;
+	}
+	if(cb.update != NULL && cb.update(c, cb_data) < 0)
+		return -1;
+	// the back buffer is still being scanned out until the last flip lands
+	if(drm_wait_flip(d) < 0)
+		return -1;
+	memcpy(back->map, d->data, back->size);
+	if(drmModePageFlip(d->fd, d->crtc_id, back->fb_id,
+	                   DRM_MODE_PAGE_FLIP_EVENT, d) < 0) {
+		perror("drmModePageFlip");
+		return -1;
+	}
+	d->flip_pending = 1;
+	d->front = !d->front;
+	return 0;
+}
+
+void drm_cleanup(struct cgbp *c) {
+	struct drm *d = c->driver_data;
+	if(d->fd >= 0) {
+		drm_wait_flip(d);
+		if(d->saved_crtc != NULL) {
+			drmModeSetCrtc(d->fd, d->saved_crtc->crtc_id,
+			               d->saved_crtc->buffer_id, d->saved_crtc->x,
+			               d->saved_crtc->y, &d->conn_id, 1,
+			               &d->saved_crtc->mode);
+			drmModeFreeCrtc(d->saved_crtc);
+		}
+		drm_destroy_buf(d, &d->bufs[0]);
+		drm_destroy_buf(d, &d->bufs[1]);
+		close(d->fd);
+	}
+	if(d->data != NULL)
+		free(d->data);
+
+	// turn on cursor
+	drm_write_term("\x1b[?25h", 6);
+	if(d->old_fl >= 0 && fcntl(STDIN_FILENO, F_SETFL, d->old_fl) < 0)
+		perror("fcntl");
+	if(d->tc_set == 1 && tcsetattr(STDIN_FILENO, TCSANOW, &d->tc) < 0)
+		perror("tcsetattr");
+	free(d);
+}
+
+uint32_t drm_get_pixel(struct cgbp *c, size_t x, size_t y) {
+	struct drm *d = c->driver_data;
+	if(x >= d->mode.hdisplay || y >= d->mode.vdisplay)
+		return 0;
+	return *(uint32_t*)&d->data[y * d->bufs[0].pitch + x * 4] & 0xffffff;
+}
+
+void drm_set_pixel(struct cgbp *c, size_t x, size_t y, uint32_t color) {
+	struct drm *d = c->driver_data;
+	if(x >= d->mode.hdisplay || y >= d->mode.vdisplay)
+		return;
+	*(uint32_t*)&d->data[y * d->bufs[0].pitch + x * 4] = color & 0xffffff;
+}
+
+struct cgbp_size drm_size(struct cgbp *c) {
+	struct drm *d = c->driver_data;
+	return (struct cgbp_size){ d->mode.hdisplay, d->mode.vdisplay };
+}
+
+struct cgbp_driver drm_driver = {
+	"drm",
+	drm_init,
+	drm_update,
+	drm_cleanup,
+	drm_get_pixel,
+	drm_set_pixel,
+	drm_size,
+	NULL,
+};
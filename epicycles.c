@@ -15,19 +15,24 @@
 #include <string.h>
 
 #include "cgbp.h"
+#include "kernel.h"
+#include "raster.h"
 
 #define STEP_DIV 256
 #define STEPS_PER_FRAME 16
 
-#define SIGN(x) ((x) < 0 ? -1 : 1)
-#define ABS(x) ((long)(x) < 0 ? -((long)(x)) : ((long)(x)))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
 // http://www.jstor.org/stable/2691465?origin=crossref&seq=1#page_scan_tab_contents
 
+/* the trail is kept as grey levels, in two planes inside a border of
+ * zeros a pixel wide: each frame blurs trail into back, swaps them, draws
+ * on trail and expands it out to the framebuffer */
 struct epicycle {
 	double rot_off, r_mul, r_mul_delta;
 	size_t prev_x, prev_y, cx, cy, scale, step;
+	uint8_t *planes;
+	struct cgbp_plane trail, back;
 };
 
 void epicycles_init(struct cgbp *c, struct epicycle *e) {
@@ -43,31 +48,7 @@ void epicycles_init(struct cgbp *c, struct epicycle *e) {
 	e->r_mul_delta = .01 / STEPS_PER_FRAME;
 }
 
-void draw_line(struct cgbp *c, struct cgbp_size size, size_t start_x,
-               size_t start_y, size_t end_x, size_t end_y, uint32_t color) {
-	long delta_x, delta_y, pos, other;
-	delta_x = end_x - start_x;
-	delta_y = end_y - start_y;
-	if((size_t)end_x < size.w && (size_t)end_y < size.h)
-		driver.set_pixel(c, end_x, end_y, color);
-	if(ABS(delta_x) < ABS(delta_y))
-		goto use_y;
-	for(pos = start_x; (size_t)pos != end_x; pos += SIGN(delta_x)) {
-		other = start_y + delta_y * ABS(pos - start_x) / ABS(delta_x);
-		if((size_t)pos < size.w && (size_t)other < size.h)
-			driver.set_pixel(c, pos, other, color);
-	}
-	return;
-use_y:
-	for(pos = start_y; (size_t)pos != end_y; pos += SIGN(delta_y)) {
-		other = start_x + delta_x * ABS(pos - start_y) / ABS(delta_y);
-		if((size_t)other < size.w && (size_t)pos < size.h)
-			driver.set_pixel(c, other, pos, color);
-	}
-	return;
-}
-
-int epicycles_step(struct cgbp *c, struct cgbp_size size, struct epicycle *e) {
+int epicycles_step(struct epicycle *e) {
 	float fx, fy;
 	size_t x, y;
 
@@ -81,7 +62,9 @@ int epicycles_step(struct cgbp *c, struct cgbp_size size, struct epicycle *e) {
 	x = fx * e->scale + e->cx;
 	y = fy * e->scale + e->cy;
 	if(e->prev_x != SIZE_MAX && e->prev_y != SIZE_MAX)
-		draw_line(c, size, e->prev_x, e->prev_y, x, y, 0xffffff);
+		cgbp_plane_line(&e->trail, cgbp_plane_rect(&e->trail),
+		                (long)e->prev_x, (long)e->prev_y, (long)x, (long)y,
+		                0xff);
 	e->prev_x = x;
 	e->prev_y = y;
 	e->step++;
@@ -93,68 +76,92 @@ int epicycles_step(struct cgbp *c, struct cgbp_size size, struct epicycle *e) {
 	return 0;
 }
 
-#define B(x) ((x) & 0xff)
 #define BLUR_FAC 128
-static inline uint32_t blur(uint32_t *c, size_t step) {
-	uint32_t x = B(c[0]) / 20 + B(c[1]) / 5 + B(c[2]) / 20 +
-	             B(c[3]) / 5 + BLUR_FAC * B(c[4]) + B(c[5]) / 5 +
-	             B(c[6]) / 20 + B(c[7]) / 5 + B(c[8]) / 20;
-	x = (x / (BLUR_FAC + 1)) & 0xff;
-	return (x << 16) | (x << 8) | x;
-	(void)step;
+/* one row of the blurred trail from the previous frame's rows around it,
+ * which reach a pixel past either end. the sum fits 16 bits, so this runs
+ * on 16 bit lanes. */
+CGBP_KERNEL(epicycles_blur_row, (uint8_t *restrict out, const uint8_t *above,
+                                 const uint8_t *cur, const uint8_t *below,
+                                 size_t w),
+            (out, above, cur, below, w)) {
+	size_t x;
+	uint16_t v;
+	for(x = 0; x < w; x++) {
+		v = above[x - 1] / 20 + above[x] / 5 + above[x + 1] / 20 +
+		    cur[x - 1] / 5 + BLUR_FAC * cur[x] + cur[x + 1] / 5 +
+		    below[x - 1] / 20 + below[x] / 5 + below[x + 1] / 20;
+		out[x] = v / (BLUR_FAC + 1);
+	}
+}
+
+CGBP_KERNEL(epicycles_expand_row, (uint32_t *restrict out, const uint8_t *in,
+                                   size_t w),
+            (out, in, w)) {
+	size_t x;
+	for(x = 0; x < w; x++)
+		out[x] = 0xff000000 | in[x] * 0x010101u;
+}
+
+static inline int epicycles_resize(struct epicycle *e, struct cgbp_size size) {
+	size_t stride = size.w + 2, len = stride * (size.h + 2);
+	uint8_t *planes = calloc(2, len);
+	if(planes == NULL) {
+		perror("calloc");
+		return -1;
+	}
+	free(e->planes);
+	e->planes = planes;
+	e->trail = (struct cgbp_plane){
+		planes + stride + 1, size.w, size.h, stride,
+	};
+	e->back = (struct cgbp_plane){
+		planes + len + stride + 1, size.w, size.h, stride,
+	};
+	return 0;
 }
 
-static inline void get_neighbors(struct cgbp *c, struct cgbp_size size,
-                                 uint32_t neighbors[], uint32_t *pline,
-                                 uint32_t *pleft, size_t x, size_t y) {
-	if(y > 0) {
-		neighbors[0] = x > 0 ? pline[x - 1] : 0;
-		neighbors[1] = pline[x];
-		neighbors[2] = x < size.w - 1 ? pline[x + 1] : 0;
-	} else
-		neighbors[0] = neighbors[1] = neighbors[2] = 0;
-
-	neighbors[3] = x > 0 ? *pleft : 0;
-	neighbors[4] = driver.get_pixel(c, x, y);
-	neighbors[5] = x < size.w - 1 ? driver.get_pixel(c, x + 1, y) : 0;
-
-	if(y < size.h - 1) {
-		neighbors[6] = x > 0 ? driver.get_pixel(c, x - 1, y + 1) : 0;
-		neighbors[7] = driver.get_pixel(c, x, y + 1);
-		neighbors[8] = x < size.w - 1 ? driver.get_pixel(c, x + 1, y + 1) : 0;
-	} else
-		neighbors[6] = neighbors[7] = neighbors[8] = 0;
+static inline void epicycles_blur(struct epicycle *e) {
+	struct cgbp_plane t = e->trail;
+	const uint8_t *row;
+	size_t y;
+	for(y = 0; y < t.h; y++) {
+		row = t.data + y * t.stride;
+		epicycles_blur_row(e->back.data + y * t.stride, row - t.stride, row,
+		                   row + t.stride, t.w);
+	}
+	e->trail = e->back;
+	e->back = t;
+}
+
+// expand the trail to grey, straight into rows where the framebuffer is 32 bit
+static inline void epicycles_present(const struct cgbp_plane *p,
+                                     const struct cgbp_fb *fb) {
+	int direct = CGBP_FB_FORMAT(fb) == CGBP_FORMAT_XRGB8888 ||
+	             CGBP_FB_FORMAT(fb) == CGBP_FORMAT_ARGB8888;
+	uint32_t line[p->w];
+	size_t x, y;
+	for(y = 0; y < p->h; y++) {
+		epicycles_expand_row(direct ? (uint32_t*)cgbp_fb_row(fb, y) : line,
+		                     p->data + y * p->stride, p->w);
+		if(!direct)
+			for(x = 0; x < p->w; x++)
+				cgbp_fb_set_pixel(fb, x, y, line[x]);
+	}
 }
 
 int epicycles_update(struct cgbp *c, void *data) {
 	struct epicycle *e = data;
 	struct cgbp_size size = driver.size(c);
-	size_t i, x, y;
-	uint32_t pline1[size.w + 1], pline2[size.w + 1], *pline_new, *pline_old,
-	         *pleft_new, *pleft_old, *tmp, neighbors[9];
-	pline_new = pline1;
-	pline_old = pline2;
-	pleft_new = &pline1[size.w];
-	pleft_old = &pline2[size.w];
-	for(y = 0; y < size.h; y++) {
-		for(x = 0; x < size.w; x++)
-			pline_new[x] = driver.get_pixel(c, x, y);
-		for(x = 0; x < size.w; x++) {
-			*pleft_new = driver.get_pixel(c, x, y);
-			get_neighbors(c, size, neighbors, pline_old, pleft_old, x, y);
-			driver.set_pixel(c, x, y, blur(neighbors, e->step));
-
-			tmp = pleft_new;
-			pleft_new = pleft_old;
-			pleft_old = tmp;
-		}
-		tmp = pline_new;
-		pline_new = pline_old;
-		pline_old = tmp;
-	}
+	struct cgbp_fb fb = c->fb;
+	size_t i;
+	if((e->planes == NULL || size.w != e->trail.w || size.h != e->trail.h) &&
+	  epicycles_resize(e, size) < 0)
+		return -1;
+	epicycles_blur(e);
 	for(i = 0; i < STEPS_PER_FRAME; i++)
-		if(epicycles_step(c, size, e) < 0)
+		if(epicycles_step(e) < 0)
 			return -1;
+	epicycles_present(&e->trail, &fb);
 	return 0;
 }
 
@@ -165,15 +172,118 @@ int epicycles_action(struct cgbp *c, void *data, char r) {
 	(void)data;
 }
 
+#define EPICYCLES_BENCH_FRAMES 32
+
+// the 32 bit blur the plane replaced, to compare against
+CGBP_KERNEL(epicycles_bench_blur32, (uint32_t *out, const uint32_t *above,
+                                     const uint32_t *cur,
+                                     const uint32_t *below, size_t w),
+            (out, above, cur, below, w)) {
+	size_t x;
+	uint32_t v;
+	for(x = 0; x < w; x++) {
+		v = (above[x - 1] & 0xff) / 20 + (above[x] & 0xff) / 5 +
+		    (above[x + 1] & 0xff) / 20 + (cur[x - 1] & 0xff) / 5 +
+		    BLUR_FAC * (cur[x] & 0xff) + (cur[x + 1] & 0xff) / 5 +
+		    (below[x - 1] & 0xff) / 20 + (below[x] & 0xff) / 5 +
+		    (below[x + 1] & 0xff) / 20;
+		v = (v / (BLUR_FAC + 1)) & 0xff;
+		out[x] = (v << 16) | (v << 8) | v;
+	}
+}
+
+// a frame's blur and copy out on a 32 bit raster, as before the plane
+static inline void epicycles_bench_frame32(uint32_t *raster, uint32_t *lines,
+                                           const struct cgbp_fb *fb) {
+	uint32_t *above = lines + 1, *cur = above + fb->w + 2,
+	         *below = cur + fb->w + 2, *tmp;
+	size_t y;
+	memset(lines, 0, 3 * (fb->w + 2) * sizeof *lines);
+	memcpy(cur, raster, fb->w * sizeof *cur);
+	for(y = 0; y < fb->h; y++) {
+		if(y < fb->h - 1)
+			memcpy(below, raster + (y + 1) * fb->w, fb->w * sizeof *below);
+		else
+			memset(below, 0, fb->w * sizeof *below);
+		epicycles_bench_blur32(raster + y * fb->w, above, cur, below, fb->w);
+		tmp = above;
+		above = cur;
+		cur = below;
+		below = tmp;
+	}
+	for(y = 0; y < fb->h; y++)
+		memcpy(cgbp_fb_row(fb, y), raster + y * fb->w,
+		       fb->w * sizeof *raster);
+}
+
+/* CGBP_BENCH: time of a frame's blur and present on the grey plane,
+ * against the 32 bit raster it replaced, for a few screen sizes */
+static int epicycles_bench(void) {
+	static const struct cgbp_size sizes[] = {
+		{ 640, 480 }, { 1920, 1080 }, { 3840, 2160 },
+	};
+	struct epicycle e = { .planes = NULL };
+	struct cgbp_fb fb = { .data = NULL };
+	uint32_t *raster = NULL, *lines = NULL;
+	size_t i, k;
+	double start, ref, plane;
+	int ret = -1;
+	if(cgbp_kernels_init() < 0)
+		return -1;
+	fprintf(stderr, "%9s %10s %10s %7s\n", "size", "32 bit ms", "plane ms",
+	        "speedup");
+	for(i = 0; i < sizeof sizes / sizeof *sizes; i++) {
+		fb = (struct cgbp_fb){
+			NULL, NULL, sizes[i].w, sizes[i].h, sizes[i].w * 4,
+			CGBP_FORMAT_XRGB8888,
+		};
+		fb.data = calloc(fb.h, fb.stride);
+		raster = calloc(fb.w * fb.h, sizeof *raster);
+		lines = malloc(3 * (fb.w + 2) * sizeof *lines);
+		if(fb.data == NULL || raster == NULL || lines == NULL) {
+			perror("malloc");
+			goto error;
+		}
+		if(epicycles_resize(&e, sizes[i]) < 0)
+			goto error;
+		start = cgbp_time();
+		for(k = 0; k < EPICYCLES_BENCH_FRAMES; k++)
+			epicycles_bench_frame32(raster, lines, &fb);
+		ref = (cgbp_time() - start) * 1e3 / EPICYCLES_BENCH_FRAMES;
+		start = cgbp_time();
+		for(k = 0; k < EPICYCLES_BENCH_FRAMES; k++) {
+			epicycles_blur(&e);
+			epicycles_present(&e.trail, &fb);
+		}
+		plane = (cgbp_time() - start) * 1e3 / EPICYCLES_BENCH_FRAMES;
+		fprintf(stderr, "%4zux%4zu %10.2f %10.2f %7.2f\n", fb.w, fb.h, ref,
+		        plane, ref / plane);
+		free(fb.data);
+		free(raster);
+		free(lines);
+		fb.data = NULL;
+		raster = lines = NULL;
+	}
+	ret = 0;
+error:
+	free(fb.data);
+	free(raster);
+	free(lines);
+	free(e.planes);
+	return ret;
+}
+
 int main(void) {
 	struct cgbp c;
 	struct cgbp_callbacks cb = {
 		.update = epicycles_update,
 		.action = epicycles_action,
 	};
-	struct epicycle e;
+	struct epicycle e = { .planes = NULL };
 	int ret = EXIT_FAILURE;
 	srand(time(NULL));
+	if(getenv("CGBP_BENCH") != NULL)
+		return epicycles_bench() < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 	if(cgbp_init(&c) < 0)
 		goto error;
 	epicycles_init(&c, &e);
@@ -182,5 +292,6 @@ int main(void) {
 		ret = EXIT_SUCCESS;
 error:
 	cgbp_cleanup(&c);
+	free(e.planes);
 	return ret;
 }
@@ -16,17 +16,39 @@
 #include <termios.h>
 #include <unistd.h>
 #include <linux/fb.h>
+#include <linux/input.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 
 #include "cgbp.h"
 
+#define EVDEV_BATCH 64
+#define KEY_BIT(keys, code) ((keys)[(code) / CHAR_BIT] >> ((code) % CHAR_BIT) & 1)
+
 struct fbdev {
 	struct fb_fix_screeninfo finfo;
 	struct fb_var_screeninfo vinfo;
 	struct termios tc;
-	int fbfd, old_fl;
-	uint8_t *fbmm, *data, tc_set: 1;
+	int fbfd, evfd, old_fl;
+	uint8_t keys[(KEY_MAX + CHAR_BIT) / CHAR_BIT];
+	uint8_t *fbmm, *data, tc_set: 1, ev_dropped: 1;
+};
+
+// us layout; enough for the alphanumeric input the demos care about
+static const char evdev_keymap[KEY_MAX + 1] = {
+	[KEY_1] = '1', [KEY_2] = '2', [KEY_3] = '3', [KEY_4] = '4',
+	[KEY_5] = '5', [KEY_6] = '6', [KEY_7] = '7', [KEY_8] = '8',
+	[KEY_9] = '9', [KEY_0] = '0', [KEY_MINUS] = '-', [KEY_EQUAL] = '=',
+	[KEY_Q] = 'q', [KEY_W] = 'w', [KEY_E] = 'e', [KEY_R] = 'r',
+	[KEY_T] = 't', [KEY_Y] = 'y', [KEY_U] = 'u', [KEY_I] = 'i',
+	[KEY_O] = 'o', [KEY_P] = 'p', [KEY_A] = 'a', [KEY_S] = 's',
+	[KEY_D] = 'd', [KEY_F] = 'f', [KEY_G] = 'g', [KEY_H] = 'h',
+	[KEY_J] = 'j', [KEY_K] = 'k', [KEY_L] = 'l', [KEY_Z] = 'z',
+	[KEY_X] = 'x', [KEY_C] = 'c', [KEY_V] = 'v', [KEY_B] = 'b',
+	[KEY_N] = 'n', [KEY_M] = 'm', [KEY_COMMA] = ',', [KEY_DOT] = '.',
+	[KEY_SLASH] = '/', [KEY_SEMICOLON] = ';', [KEY_APOSTROPHE] = '\'',
+	[KEY_SPACE] = ' ', [KEY_ENTER] = '\n', [KEY_TAB] = '\t',
+	[KEY_ESC] = '\x1b', [KEY_BACKSPACE] = '\b',
 };
 
 static inline ssize_t fbdev_write_term(const char *str, size_t len) {
@@ -40,6 +62,37 @@ static inline ssize_t fbdev_write_term(const char *str, size_t len) {
 	return ret;
 }
 
+/* optional: with CGBP_EVDEV=/dev/input/eventN, keyboard input is read from
+ * evdev instead of the tty, which gives us key-up events and held keys. */
+static inline int fbdev_init_evdev(struct fbdev *f) {
+	const char *path = getenv("CGBP_EVDEV");
+	memset(f->keys, 0, sizeof f->keys);
+	f->ev_dropped = 0;
+	f->evfd = -1;
+	if(path == NULL || *path == '\0')
+		return 0;
+	f->evfd = open(path, O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+	if(f->evfd < 0) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+#define FB_BITFIELD(bf, off, len) ((bf).offset == (off) && (bf).length == (len))
+static inline enum cgbp_format fbdev_format(struct fb_var_screeninfo *v) {
+	if(v->bits_per_pixel == 32 && FB_BITFIELD(v->red, 16, 8) &&
+	  FB_BITFIELD(v->green, 8, 8) && FB_BITFIELD(v->blue, 0, 8))
+		return CGBP_FORMAT_XRGB8888;
+	if(v->bits_per_pixel == 24 && FB_BITFIELD(v->red, 16, 8) &&
+	  FB_BITFIELD(v->green, 8, 8) && FB_BITFIELD(v->blue, 0, 8))
+		return CGBP_FORMAT_RGB888;
+	if(v->bits_per_pixel == 16 && FB_BITFIELD(v->red, 11, 5) &&
+	  FB_BITFIELD(v->green, 5, 6) && FB_BITFIELD(v->blue, 0, 5))
+		return CGBP_FORMAT_RGB565;
+	return CGBP_FORMAT_UNKNOWN;
+}
+
 void fbdev_cleanup(struct cgbp *c);
 
 int fbdev_init(struct cgbp *c) {
@@ -51,7 +104,14 @@ int fbdev_init(struct cgbp *c) {
 		return -1;
 	}
 	c->driver_data = f;
+	f->fbmm = NULL;
+	f->data = NULL;
+	f->tc_set = 0;
+	f->old_fl = -1;
+	f->fbfd = -1;
 
+	if(fbdev_init_evdev(f) < 0)
+		goto error;
 	f->fbfd = open("/dev/fb0", O_RDWR);
 	if(f->fbfd < 0) {
 		perror("open");
@@ -77,6 +137,11 @@ int fbdev_init(struct cgbp *c) {
 		goto error;
 	}
 	memset(f->data, 0, buffer_size);
+	c->fb.data = f->data;
+	c->fb.w = f->vinfo.xres;
+	c->fb.h = f->vinfo.yres;
+	c->fb.stride = f->finfo.line_length;
+	c->fb.format = fbdev_format(&f->vinfo);
 
 	// turn off cursor
 	fbdev_write_term("\x1b[?25l", 6);
@@ -103,12 +168,69 @@ error:
 	return -1;
 }
 
-struct cgbp_driver driver;
+static inline int fbdev_read_evdev(struct cgbp *c, void *cb_data,
+                                   struct cgbp_callbacks cb) {
+	struct fbdev *f = c->driver_data;
+	struct input_event ev[EVDEV_BATCH];
+	ssize_t len, i;
+	char r;
+	// the tty still receives the keystrokes; don't let them pile up
+	tcflush(STDIN_FILENO, TCIFLUSH);
+	for(;;) {
+		len = read(f->evfd, ev, sizeof ev);
+		if(len < 0) {
+			if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				return 0;
+			perror("read");
+			return -1;
+		}
+		for(i = 0; i < len / (ssize_t)sizeof *ev; i++) {
+			/* the kernel's buffer overran and events were lost, releases
+			 * among them maybe: skip to the next report, then ask for the
+			 * keys held now */
+			if(ev[i].type == EV_SYN && ev[i].code == SYN_DROPPED) {
+				f->ev_dropped = 1;
+				continue;
+			}
+			if(f->ev_dropped) {
+				if(ev[i].type != EV_SYN || ev[i].code != SYN_REPORT)
+					continue;
+				f->ev_dropped = 0;
+				if(ioctl(f->evfd, EVIOCGKEY(sizeof f->keys), f->keys) < 0) {
+					perror("EVIOCGKEY");
+					return -1;
+				}
+				continue;
+			}
+			if(ev[i].type != EV_KEY || ev[i].code > KEY_MAX)
+				continue;
+			if(ev[i].value == 0) {
+				f->keys[ev[i].code / CHAR_BIT] &= ~(1 << ev[i].code % CHAR_BIT);
+				continue;
+			}
+			// 1 is a press, 2 an autorepeat
+			f->keys[ev[i].code / CHAR_BIT] |= 1 << ev[i].code % CHAR_BIT;
+			r = evdev_keymap[ev[i].code];
+			if(r == '\0' || cb.action == NULL)
+				continue;
+			if(r >= 'a' && r <= 'z' && (KEY_BIT(f->keys, KEY_LEFTSHIFT) ||
+			  KEY_BIT(f->keys, KEY_RIGHTSHIFT)))
+				r += 'A' - 'a';
+			if(cb.action(c, cb_data, r) < 0)
+				return -1;
+		}
+		if((size_t)len < sizeof ev)
+			return 0;
+	}
+}
 
 int fbdev_update(struct cgbp *c, void *cb_data, struct cgbp_callbacks cb) {
 	struct fbdev *f = c->driver_data;
 	char r;
-	if(cb.action != NULL) {
+	if(f->evfd >= 0) {
+		if(fbdev_read_evdev(c, cb_data, cb) < 0)
+			return -1;
+	} else if(cb.action != NULL) {
 		if(read(STDIN_FILENO, &r, 1) > 0 && cb.action(c, cb_data, r) < 0)
 			return -1;
 	}
@@ -128,10 +250,12 @@ void fbdev_cleanup(struct cgbp *c) {
 		close(f->fbfd);
 	if(f->data != NULL)
 		free(f->data);
+	if(f->evfd >= 0)
+		close(f->evfd);
 
 	// turn on cursor
 	fbdev_write_term("\x1b[?25h", 6);
-	if(fcntl(STDIN_FILENO, F_SETFL, f->old_fl) < 0)
+	if(f->old_fl >= 0 && fcntl(STDIN_FILENO, F_SETFL, f->old_fl) < 0)
 		perror("fcntl");
 	if(f->tc_set == 1 && tcsetattr(STDIN_FILENO, TCSANOW, &f->tc) < 0)
 		perror("tcsetattr");
@@ -145,6 +269,8 @@ uint32_t fbdev_get_pixel(struct cgbp *c, size_t x, size_t y) {
 	uint32_t value = 0, i;
 	if(x >= f->vinfo.xres || y >= f->vinfo.yres)
 		return 0;
+	if(c->fb.format != CGBP_FORMAT_UNKNOWN)
+		return cgbp_fb_get_pixel(&c->fb, x, y);
 	for(i = 0; i < bytes_pp; i++)
 		value |= f->data[base + i] << (8 * i);
 	return value & 0xffffff;
@@ -154,8 +280,12 @@ void fbdev_set_pixel(struct cgbp *c, size_t x, size_t y, uint32_t color) {
 	struct fbdev *f = c->driver_data;
 	size_t bytes_pp = f->vinfo.bits_per_pixel / CHAR_BIT;
 	size_t base = y * f->finfo.line_length + x * bytes_pp, i;
-	if(x > f->vinfo.xres || y > f->vinfo.yres)
+	if(x >= f->vinfo.xres || y >= f->vinfo.yres)
+		return;
+	if(c->fb.format != CGBP_FORMAT_UNKNOWN) {
+		cgbp_fb_set_pixel(&c->fb, x, y, color);
 		return;
+	}
 	for(i = 0; i < bytes_pp; i++)
 		f->data[base + i] = color >> (8 * i);
 }
@@ -165,11 +295,26 @@ struct cgbp_size fbdev_size(struct cgbp *c) {
 	return (struct cgbp_size){ f->vinfo.xres, f->vinfo.yres };
 }
 
-struct cgbp_driver driver = {
+int fbdev_key_pressed(struct cgbp *c, char key) {
+	struct fbdev *f = c->driver_data;
+	size_t i;
+	if(f->evfd < 0)
+		return -1;
+	if(key >= 'A' && key <= 'Z')
+		key += 'a' - 'A';
+	for(i = 0; i < sizeof evdev_keymap; i++)
+		if(evdev_keymap[i] == key)
+			return KEY_BIT(f->keys, i);
+	return 0;
+}
+
+struct cgbp_driver fbdev_driver = {
+	"fbdev",
 	fbdev_init,
 	fbdev_update,
 	fbdev_cleanup,
 	fbdev_get_pixel,
 	fbdev_set_pixel,
 	fbdev_size,
+	fbdev_key_pressed,
 };
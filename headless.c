@@ -0,0 +1,106 @@
+/* headless.c
+ *
+ * Copyright (c) 2018, mar77i <mar77i at protonmail dot ch>
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license.  See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cgbp.h"
+
+#define HEADLESS_W 640
+#define HEADLESS_H 480
+
+/* renders into memory only; CGBP_SIZE=WxH sets the canvas size and
+ * CGBP_FRAMES=n stops the main loop after n frames */
+struct headless {
+	uint32_t *data;
+	size_t w, h, frames, max_frames;
+};
+
+int headless_init(struct cgbp *c) {
+	struct headless *h = malloc(sizeof *h);
+	const char *env;
+	if(h == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	c->driver_data = h;
+	h->w = HEADLESS_W;
+	h->h = HEADLESS_H;
+	h->frames = 0;
+	h->max_frames = 0;
+	env = getenv("CGBP_SIZE");
+	if(env != NULL && (sscanf(env, "%zux%zu", &h->w, &h->h) != 2 ||
+	  h->w == 0 || h->h == 0)) {
+		fprintf(stderr, "Error: CGBP_SIZE: expected WxH.\n");
+		goto error;
+	}
+	env = getenv("CGBP_FRAMES");
+	if(env != NULL)
+		h->max_frames = strtoul(env, NULL, 10);
+	h->data = calloc(h->w * h->h, sizeof *h->data);
+	if(h->data == NULL) {
+		perror("calloc");
+		goto error;
+	}
+	c->fb.data = (uint8_t*)h->data;
+	c->fb.w = h->w;
+	c->fb.h = h->h;
+	c->fb.stride = h->w * sizeof *h->data;
+	c->fb.format = CGBP_FORMAT_XRGB8888;
+	return 0;
+error:
+	free(h);
+	c->driver_data = NULL;
+	return -1;
+}
+
+int headless_update(struct cgbp *c, void *cb_data, struct cgbp_callbacks cb) {
+	struct headless *h = c->driver_data;
+	if(cb.update != NULL && cb.update(c, cb_data) < 0)
+		return -1;
+	if(++h->frames == h->max_frames)
+		c->running = 0;
+	return 0;
+}
+
+void headless_cleanup(struct cgbp *c) {
+	struct headless *h = c->driver_data;
+	free(h->data);
+	free(h);
+}
+
+uint32_t headless_get_pixel(struct cgbp *c, size_t x, size_t y) {
+	struct headless *h = c->driver_data;
+	if(x >= h->w || y >= h->h)
+		return 0;
+	return h->data[y * h->w + x];
+}
+
+void headless_set_pixel(struct cgbp *c, size_t x, size_t y, uint32_t color) {
+	struct headless *h = c->driver_data;
+	if(x >= h->w || y >= h->h)
+		return;
+	h->data[y * h->w + x] = color & 0xffffff;
+}
+
+struct cgbp_size headless_size(struct cgbp *c) {
+	struct headless *h = c->driver_data;
+	return (struct cgbp_size){ h->w, h->h };
+}
+
+struct cgbp_driver headless_driver = {
+	"headless",
+	headless_init,
+	headless_update,
+	headless_cleanup,
+	headless_get_pixel,
+	headless_set_pixel,
+	headless_size,
+	NULL,
+};
@@ -59,4 +59,25 @@ static inline void hsv_to_rgb(double result[], double h, double s, double v) {
 	}
 }
 
+static inline double hsv_channel(double n, double h6, double s, double v) {
+	double k = n + h6, m;
+	if(k >= 6)
+		k -= 6;
+	m = 4 - k < k ? 4 - k : k;
+	if(m > 1)
+		m = 1;
+	else if(m < 0)
+		m = 0;
+	return v - v * s * m;
+}
+
+// branch-free equivalent of hsv_to_rgb, for loops that should vectorize
+static inline void hsv_to_rgb_vec(double result[], double h, double s,
+                                  double v) {
+	double h6 = (h - floor(h)) * 6.0;
+	result[0] = hsv_channel(5, h6, s, v);
+	result[1] = hsv_channel(3, h6, s, v);
+	result[2] = hsv_channel(1, h6, s, v);
+}
+
 #endif // HSV_H
@@ -0,0 +1,69 @@
+/* kernel.c
+ *
+ * Copyright (c) 2018, mar77i <mar77i at protonmail dot ch>
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license.  See the LICENSE file for details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernel.h"
+
+const char *const cgbp_isa_names[CGBP_ISA_MAX] = {
+	"scalar",
+	"sse4.1",
+	"avx2",
+	"avx512",
+};
+
+enum cgbp_isa cgbp_isa = CGBP_ISA_SCALAR;
+
+static struct cgbp_kernel *cgbp_kernels = NULL;
+
+// called from constructors, before main
+void cgbp_kernel_register(struct cgbp_kernel *k) {
+	k->next = cgbp_kernels;
+	cgbp_kernels = k;
+}
+
+static inline enum cgbp_isa cgbp_isa_detect(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+		return CGBP_ISA_AVX512;
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return CGBP_ISA_AVX2;
+	if(__builtin_cpu_supports("sse4.1"))
+		return CGBP_ISA_SSE41;
+#endif
+	return CGBP_ISA_SCALAR;
+}
+
+int cgbp_kernels_init(void) {
+	const char *name = getenv("CGBP_ISA");
+	enum cgbp_isa isa, supported = cgbp_isa_detect();
+	struct cgbp_kernel *k;
+	isa = supported;
+	if(name != NULL) {
+		for(isa = 0; isa < CGBP_ISA_MAX; isa++)
+			if(strcmp(name, cgbp_isa_names[isa]) == 0)
+				break;
+		if(isa == CGBP_ISA_MAX) {
+			fprintf(stderr, "Error: CGBP_ISA: unknown variant \"%s\".\n", name);
+			return -1;
+		}
+		if(isa > supported) {
+			fprintf(stderr, "CGBP_ISA: %s not supported, using %s\n",
+			        name, cgbp_isa_names[supported]);
+			isa = supported;
+		}
+	}
+	cgbp_isa = isa;
+	for(k = cgbp_kernels; k != NULL; k = k->next)
+		k->select(isa);
+	fprintf(stderr, "isa: %s\n", cgbp_isa_names[isa]);
+	return 0;
+}
@@ -0,0 +1,81 @@
+/* kernel.h
+ *
+ * Copyright (c) 2018, mar77i <mar77i at protonmail dot ch>
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license.  See the LICENSE file for details.
+ */
+
+#ifndef KERNEL_H
+#define KERNEL_H
+
+enum cgbp_isa {
+	CGBP_ISA_SCALAR,
+	CGBP_ISA_SSE41,
+	CGBP_ISA_AVX2,
+	CGBP_ISA_AVX512,
+	CGBP_ISA_MAX,
+};
+
+struct cgbp_kernel {
+	const char *name;
+	void (*select)(enum cgbp_isa);
+	struct cgbp_kernel *next;
+};
+
+extern const char *const cgbp_isa_names[CGBP_ISA_MAX];
+
+// the variant picked at cgbp_init, from cpuid or CGBP_ISA
+extern enum cgbp_isa cgbp_isa;
+
+void cgbp_kernel_register(struct cgbp_kernel *k);
+int cgbp_kernels_init(void);
+
+#define CGBP_KERNEL_ALWAYS_INLINE static inline __attribute__((always_inline))
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CGBP_KERNEL_VARIANT(name, suffix, arch, params, args) \
+	static __attribute__((target(arch))) void name##_##suffix params { \
+		name##_impl args; \
+	}
+#define CGBP_KERNEL_SELECT(name, isa) \
+	name = (isa) >= CGBP_ISA_AVX512 ? name##_avx512 : \
+	       (isa) >= CGBP_ISA_AVX2 ? name##_avx2 : \
+	       (isa) >= CGBP_ISA_SSE41 ? name##_sse41 : name##_scalar
+#else
+#define CGBP_KERNEL_VARIANT(name, suffix, arch, params, args)
+#define CGBP_KERNEL_SELECT(name, isa) name = name##_scalar
+#endif
+
+/* define a hot kernel in several ISA variants, e.g.
+ *
+ *	CGBP_KERNEL(blur_row, (uint8_t *dst, const uint8_t *src, size_t n),
+ *	            (dst, src, n)) {
+ *		...
+ *	}
+ *
+ * the body is written once in plain C and compiled for each target; calls
+ * to blur_row(...) go through a function pointer that cgbp_init points at
+ * the best variant for this cpu. */
+#define CGBP_KERNEL(name, params, args) \
+	CGBP_KERNEL_ALWAYS_INLINE void name##_impl params; \
+	static void name##_scalar params { \
+		name##_impl args; \
+	} \
+	CGBP_KERNEL_VARIANT(name, sse41, "sse4.1", params, args) \
+	CGBP_KERNEL_VARIANT(name, avx2, "avx2,fma", params, args) \
+	CGBP_KERNEL_VARIANT(name, avx512, "avx512f,avx512bw,avx2,fma", \
+	                    params, args) \
+	static void (*name) params = name##_scalar; \
+	static void name##_select(enum cgbp_isa isa) { \
+		CGBP_KERNEL_SELECT(name, isa); \
+	} \
+	static struct cgbp_kernel name##_kernel = { \
+		#name, name##_select, NULL, \
+	}; \
+	__attribute__((constructor)) static void name##_register(void) { \
+		cgbp_kernel_register(&name##_kernel); \
+	} \
+	CGBP_KERNEL_ALWAYS_INLINE void name##_impl params
+
+#endif // KERNEL_H
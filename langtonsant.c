@@ -32,14 +32,14 @@ int langtonsant_init(struct langtonsant *l, struct cgbp_size size) {
 	return 0;
 }
 
-void langtonsant_step(struct cgbp *c, struct langtonsant *l) {
-	struct cgbp_size size = driver.size(c);
-	if(driver.get_pixel(c, l->x, l->y) == 0) {
+static inline void langtonsant_step(struct cgbp_fb *fb, struct langtonsant *l) {
+	struct cgbp_size size = { fb->w, fb->h };
+	if(cgbp_fb_get_pixel(fb, l->x, l->y) == 0) {
 		l->direction++;
-		driver.set_pixel(c, l->x, l->y, 0xffffff);
+		cgbp_fb_set_pixel(fb, l->x, l->y, 0xffffff);
 	} else {
 		l->direction--;
-		driver.set_pixel(c, l->x, l->y, 0);
+		cgbp_fb_set_pixel(fb, l->x, l->y, 0);
 	}
 	switch(nonneg_mod(l->direction, 4)) {
 	case 0:
@@ -77,9 +77,10 @@ int langtonsant_action(struct cgbp *c, void *data, char r) {
 }
 
 int langtonsant_update(struct cgbp *c, void *data) {
+	struct cgbp_fb fb = c->fb;
 	size_t i;
 	for(i = 0; i < 100000; i++)
-		langtonsant_step(c, data);
+		langtonsant_step(&fb, data);
 	return 0;
 }
 
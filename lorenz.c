@@ -6,11 +6,37 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "cgbp.h"
 #include "hsv.h"
+#include "kernel.h"
+#include "pool.h"
+#include "raster.h"
 
 #define MIN_Z .2
+#define LORENZ_CHUNK 1024
+// segments per turn of the colour wheel
+#define LORENZ_RAMP 1000
+// default LORENZ_MEMORY, in MiB of points
+#define LORENZ_MEMORY 16
+#define LORENZ_MIN_CHUNKS 4
+// tolerance doubles per level from a pixel; past the last, history drops
+#define LORENZ_LEVELS 5
+// longest stretch of points a decimated segment replaces
+#define LORENZ_RUN 32
+// about the closest the camera gets to a point of the box, in box units
+#define LORENZ_NEAR .75
+// particle cloud: rk4 steps of dt per frame, seed cube, fixed extent
+#define LORENZ_SUBSTEPS 4
+#define LORENZ_SPREAD .5
+#define LORENZ_EXTENT 50
+// rows per tone mapping task, and densities told apart
+#define LORENZ_BAND 16
+#define LORENZ_TONE 4096
+// full redraws are split into tiles of this many pixels square
+#define LORENZ_TILE 64
 
 #define SIGN(x) ((x) < 0 ? -1 : 1)
 #define ABS(x) ((long)(x) < 0 ? -((long)(x)) : ((long)(x)))
@@ -22,7 +48,32 @@
 
 struct point2d { float x, y; };
 struct point3d { float x, y, z; };
+struct point_hue { struct point3d p; uint16_t hue; };
 
+/* scaling by maxext, moving and rotating by the camera and scaling by fac
+ * in one: each row is a coordinate, affine in the point's x, y and z, and
+ * the screen position is centre + (x, -y) / z */
+struct xform {
+	float m[3][4], cx, cy;
+};
+
+/* raster caches the bounding box and trajectory drawn so far, opaque, so
+ * a frame only draws the newest segment onto it from tail, and copies it
+ * out. it's drawn again from the start when redraw is set, as the camera
+ * or maxext change, or the screen size. points are kept by coordinate in
+ * chunks, with their place on the colour ramp.
+ *
+ * the chunks are a ring of a fixed num_chunks, count of them in use from
+ * head, oldest first. new points go at the end; once it's full, the older
+ * half is decimated to a coarser level, see lorenz_compact.
+ *
+ * a redraw projects the chunks through xf across the pool, into sx, sy
+ * and shue back to back from chunk_start, with the tile of each point in
+ * stx and sty, -1 or one past the last off screen. segment i runs from
+ * point i - 1 to i, and tile_segs lists the segments crossing each tile from
+ * tile_start, in order, so each worker draws whole tiles on its own. the
+ * lists are filled a range of segments per worker, each from its own
+ * cursors in tile_fill. */
 struct lorenz {
 	struct cam {
 		float rotxz, rotyz, fac;
@@ -31,31 +82,162 @@ struct lorenz {
 	} c;
 	float dt, maxext;
 	struct point_bucket {
-		struct point3d p[1024];
+		float x[LORENZ_CHUNK], y[LORENZ_CHUNK], z[LORENZ_CHUNK];
+		uint16_t hue[LORENZ_CHUNK];
 		size_t num;
-		struct point_bucket *next;
-	} bucket, *last;
+		uint8_t level;
+	} *chunks;
+	size_t num_chunks, head, count, compactions;
+	uint16_t hue;
+	struct cgbp_raster raster;
+	struct xform xf;
+	float *sx, *sy;
+	uint16_t *shue;
+	int16_t *stx, *sty;
+	size_t *chunk_start, tiles_w, tiles_h, num_segs, tile_segs_len;
+	uint32_t *tile_start, *tile_fill, *tile_segs;
+	struct point2d tail;
+	uint32_t ramp[LORENZ_RAMP];
+	uint8_t redraw: 1;
+	struct cgbp_pool pool;
+	/* with LORENZ_PARTICLES, num particles are integrated instead, a chunk
+	 * per task, and counted into one density plane per worker. the planes
+	 * are summed and tone mapped a band of rows per task, against the
+	 * previous frame's peak, and cleared for the next. */
+	struct lorenz_cloud {
+		float *x, *y, *z, *sx, *sy;
+		uint32_t *density, *lines, peak[CGBP_POOL_MAX];
+		uint32_t palette[256], tone[LORENZ_TONE];
+		size_t num, planes;
+		struct cgbp_size size;
+		struct xform xf;
+		const struct cgbp_fb *out;
+	} cloud;
 };
 
-static inline struct point2d rotate(const struct point2d p, float rad) {
-	float c = cosf(rad), s = sinf(rad);
-	return (struct point2d){ p.x * c - p.y * s, p.y * c + p.x * s };
+// build the transform for points scaled down by scale
+static inline void xform_init(struct xform *t, const struct cam *c,
+                              float scale, struct cgbp_size size) {
+	float c1 = cosf(c->rotxz), s1 = sinf(c->rotxz);
+	float c2 = cosf(c->rotyz), s2 = sinf(c->rotyz);
+	// the point relative to the camera, as coefficients of x, y, z and 1
+	float x[4] = { 1 / scale, 0, 0, -c->pos.x };
+	float y[4] = { 0, 1 / scale, 0, -c->pos.y };
+	float z[4] = { 0, 0, 1 / scale, -c->pos.z };
+	float xz;
+	size_t i;
+	for(i = 0; i < 4; i++) {
+		xz = z[i] * c1 + x[i] * s1;
+		t->m[0][i] = c->fac * (x[i] * c1 - z[i] * s1);
+		t->m[1][i] = c->fac * (y[i] * c2 - xz * s2);
+		t->m[2][i] = xz * c2 + y[i] * s2;
+	}
+	t->cx = size.w / 2;
+	t->cy = size.h / 2;
+}
+
+CGBP_KERNEL_ALWAYS_INLINE struct point2d xform_apply(const struct xform *t,
+                                                     float x, float y,
+                                                     float z) {
+	float rz = 1 / (t->m[2][0] * x + t->m[2][1] * y + t->m[2][2] * z +
+	                t->m[2][3]);
+	return (struct point2d){
+		t->cx + rz * (t->m[0][0] * x + t->m[0][1] * y + t->m[0][2] * z +
+		              t->m[0][3]),
+		t->cy - rz * (t->m[1][0] * x + t->m[1][1] * y + t->m[1][2] * z +
+		              t->m[1][3]),
+	};
 }
 
-#define X_FROM_XZ (xz.x)
-#define Z_FROM_XZ (xz.y)
-#define Y_FROM_YZ (yz.x)
-#define Z_FROM_YZ (yz.y)
-struct point2d cam_vt(struct cam *c, struct point3d p) {
-	struct point2d xz, yz;
-	float fac;
-	p.x -= c->pos.x;
-	p.y -= c->pos.y;
-	p.z -= c->pos.z;
-	xz = rotate((struct point2d){ p.x, p.z }, c->rotxz);
-	yz = rotate((struct point2d){ p.y, Z_FROM_XZ }, c->rotyz);
-	fac = c->fac / Z_FROM_YZ;
-	return (struct point2d){ fac * X_FROM_XZ, fac * Y_FROM_YZ };
+// project n points to screen coordinates
+CGBP_KERNEL(lorenz_project, (const struct xform *t, const float *x,
+                             const float *y, const float *z,
+                             float *restrict sx, float *restrict sy,
+                             size_t n),
+            (t, x, y, z, sx, sy, n)) {
+	const struct xform u = *t;
+	struct point2d p;
+	int32_t i, w = n;
+	for(i = 0; i < w; i++) {
+		p = xform_apply(&u, x[i], y[i], z[i]);
+		sx[i] = p.x;
+		sy[i] = p.y;
+	}
+}
+
+CGBP_KERNEL_ALWAYS_INLINE struct point3d lorenz_velocity(struct point3d p) {
+	static const struct point3d param = { 10., 28., 8. / 3. };
+	return (struct point3d){
+		param.x * (p.y - p.x),
+		p.x * (param.y - p.z) - p.y,
+		p.x * p.y - param.z * p.z,
+	};
+}
+
+// advance n particles by steps rk4 steps of dt
+CGBP_KERNEL(lorenz_rk4, (float *restrict x, float *restrict y,
+                         float *restrict z, size_t n, float dt,
+                         size_t steps),
+            (x, y, z, n, dt, steps)) {
+	struct point3d p, k1, k2, k3, k4;
+	int32_t i, k, w = n, s = steps;
+	for(k = 0; k < s; k++)
+		for(i = 0; i < w; i++) {
+			p = (struct point3d){ x[i], y[i], z[i] };
+			k1 = lorenz_velocity(p);
+			k2 = lorenz_velocity((struct point3d){ p.x + k1.x * dt / 2,
+			                                       p.y + k1.y * dt / 2,
+			                                       p.z + k1.z * dt / 2 });
+			k3 = lorenz_velocity((struct point3d){ p.x + k2.x * dt / 2,
+			                                       p.y + k2.y * dt / 2,
+			                                       p.z + k2.z * dt / 2 });
+			k4 = lorenz_velocity((struct point3d){ p.x + k3.x * dt,
+			                                       p.y + k3.y * dt,
+			                                       p.z + k3.z * dt });
+			x[i] = p.x + (k1.x + 2 * (k2.x + k3.x) + k4.x) * dt / 6;
+			y[i] = p.y + (k1.y + 2 * (k2.y + k3.y) + k4.y) * dt / 6;
+			z[i] = p.z + (k1.z + 2 * (k2.z + k3.z) + k4.z) * dt / 6;
+		}
+}
+
+// sum n densities over the planes, clearing them, and tone map them
+CGBP_KERNEL(lorenz_tone_row, (uint32_t *restrict out,
+                              uint32_t *restrict density, size_t planes,
+                              size_t stride, const uint32_t *tone,
+                              uint32_t *peak, size_t n),
+            (out, density, planes, stride, tone, peak, n)) {
+	int32_t x, w = n;
+	uint32_t d, *plane, top = *peak;
+	size_t p;
+	// sum into out first, a plane at a time
+	for(x = 0; x < w; x++) {
+		out[x] = density[x];
+		density[x] = 0;
+	}
+	for(p = 1; p < planes; p++) {
+		plane = density + p * stride;
+		for(x = 0; x < w; x++) {
+			out[x] += plane[x];
+			plane[x] = 0;
+		}
+	}
+	for(x = 0; x < w; x++) {
+		d = out[x];
+		top = d > top ? d : top;
+		out[x] = tone[d < LORENZ_TONE ? d : LORENZ_TONE - 1];
+	}
+	*peak = top;
+}
+
+// one colour per step of .001 around the hue circle
+static inline void lorenz_ramp(uint32_t *ramp) {
+	double rgb[3] = { 0 };
+	size_t i;
+	for(i = 0; i < LORENZ_RAMP; i++) {
+		hsv_to_rgb(rgb, (double)i / LORENZ_RAMP, 1, 1);
+		ramp[i] = 0xff000000 |
+		          TO_RGB(rgb[0] * 0xff, rgb[1] * 0xff, rgb[2] * 0xff);
+	}
 }
 
 void cam_updatepos(struct cam *c) {
@@ -70,31 +252,8 @@ void cam_dump(struct cam *c) {
 	       c->rotxz, c->rotyz, c->fac, c->pos.x, c->pos.y, c->pos.z);
 }
 
-void draw_line(struct cgbp *c, struct cgbp_size size, size_t start_x,
-               size_t start_y, size_t end_x, size_t end_y, uint32_t color) {
-	long delta_x, delta_y, pos, other;
-	delta_x = end_x - start_x;
-	delta_y = end_y - start_y;
-	if((size_t)end_x < size.w && (size_t)end_y < size.h)
-		driver.set_pixel(c, end_x, end_y, color);
-	if(ABS(delta_x) < ABS(delta_y))
-		goto use_y;
-	for(pos = start_x; (size_t)pos != end_x; pos += SIGN(delta_x)) {
-		other = start_y + delta_y * ABS(pos - start_x) / ABS(delta_x);
-		if((size_t)pos < size.w && (size_t)other < size.h)
-			driver.set_pixel(c, pos, other, color);
-	}
-	return;
-use_y:
-	for(pos = start_y; (size_t)pos != end_y; pos += SIGN(delta_y)) {
-		other = start_x + delta_x * ABS(pos - start_y) / ABS(delta_y);
-		if((size_t)other < size.w && (size_t)pos < size.h)
-			driver.set_pixel(c, other, pos, color);
-	}
-	return;
-}
-
-void draw_bounding_box(struct cgbp *cg, struct cgbp_size size, struct cam *c) {
+void draw_bounding_box(const struct cgbp_raster *r, struct cgbp_rect clip,
+                       struct cam *c) {
 	struct point3d box[8] = {
 		{ -1, -1, -1 },
 		{  1, -1, -1 },
@@ -106,119 +265,884 @@ void draw_bounding_box(struct cgbp *cg, struct cgbp_size size, struct cam *c) {
 		{ -1,  1,  1 },
 	};
 	struct point2d box2d[8];
+	struct xform t;
 	size_t i, j;
-	for(i = 0; i < 8; i++) {
-		box2d[i] = cam_vt(c, box[i]);
-		box2d[i].x += size.w / 2;
-		box2d[i].y = size.h / 2 - box2d[i].y;
-	}
+	xform_init(&t, c, 1, (struct cgbp_size){ r->w, r->h });
+	for(i = 0; i < 8; i++)
+		box2d[i] = xform_apply(&t, box[i].x, box[i].y, box[i].z);
 	for(i = 0; i < 8; i++)
 		for(j = i + 1; j < 8; j++)
 			if((box[i].x == box[j].x) + (box[i].y == box[j].y) +
 			  (box[i].z == box[j].z) == 2)
-				draw_line(cg, size, box2d[i].x, box2d[i].y,
-				          box2d[j].x, box2d[j].y, 0xffffff);
+				cgbp_raster_line(r, clip, box2d[i].x, box2d[i].y,
+				                 box2d[j].x, box2d[j].y, 0xffffffff);
+}
+
+static inline struct point_bucket *lorenz_chunk(const struct lorenz *l,
+                                               size_t i) {
+	return &l->chunks[(l->head + i) % l->num_chunks];
+}
+
+/* keep mib worth of chunks, with room to project them all, or the fewest
+ * for 0, as particles don't keep any history; threads 0 sizes the pool
+ * from CGBP_THREADS */
+static inline int lorenz_init(struct lorenz *l, double mib, size_t threads) {
+	size_t n;
+	l->num_chunks = mib * 1024 * 1024 / (sizeof *l->chunks + LORENZ_CHUNK *
+	                (sizeof *l->sx + sizeof *l->sy + sizeof *l->shue +
+	                 sizeof *l->stx + sizeof *l->sty));
+	if(l->num_chunks < LORENZ_MIN_CHUNKS)
+		l->num_chunks = LORENZ_MIN_CHUNKS;
+	if(cgbp_pool_init(&l->pool, threads) < 0)
+		return -1;
+	n = l->num_chunks * LORENZ_CHUNK;
+	l->chunks = malloc(l->num_chunks * sizeof *l->chunks);
+	l->chunk_start = malloc((l->num_chunks + 1) * sizeof *l->chunk_start);
+	l->sx = malloc(n * sizeof *l->sx);
+	l->sy = malloc(n * sizeof *l->sy);
+	l->shue = malloc(n * sizeof *l->shue);
+	l->stx = malloc(n * sizeof *l->stx);
+	l->sty = malloc(n * sizeof *l->sty);
+	if(l->chunks == NULL || l->chunk_start == NULL || l->sx == NULL ||
+	  l->sy == NULL || l->shue == NULL || l->stx == NULL || l->sty == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	l->head = 0;
+	l->count = 1;
+	l->chunks[0].num = 0;
+	l->chunks[0].level = 0;
+	return 0;
+}
+
+static inline float dot(struct point3d a, struct point3d b) {
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+// squared distance of p from the segment from a to b
+static inline float segment_dist2(struct point3d a, struct point3d b,
+                                  struct point3d p) {
+	struct point3d d = { b.x - a.x, b.y - a.y, b.z - a.z };
+	struct point3d e = { p.x - a.x, p.y - a.y, p.z - a.z };
+	float dd = dot(d, d), t = dd > 0 ? dot(e, d) / dd : 0;
+	t = t < 0 ? 0 : t > 1 ? 1 : t;
+	e = (struct point3d){ e.x - t * d.x, e.y - t * d.y, e.z - t * d.z };
+	return dot(e, e);
+}
+
+// write p as the n-th point from the start of the ring
+static inline void lorenz_put(struct lorenz *l, size_t n, struct point_hue p,
+                              uint8_t level) {
+	struct point_bucket *b = lorenz_chunk(l, n / LORENZ_CHUNK);
+	n %= LORENZ_CHUNK;
+	b->x[n] = p.p.x;
+	b->y[n] = p.p.y;
+	b->z[n] = p.p.z;
+	b->hue[n] = p.hue;
+	b->num = n + 1;
+	b->level = n > 0 ? MAX(b->level, level) : level;
+}
+
+// how far a point may have moved by the time it's at level
+static inline float lorenz_tol(const struct lorenz *l, uint8_t level) {
+	return level > 0 ?
+	       (1 << (level - 1)) * LORENZ_NEAR * l->maxext / l->c.fac : 0;
+}
+
+/* decimate the first span chunks in place, to level: a point is dropped
+ * where the points since the last one kept all stay within the level's
+ * tolerance of the segment that then replaces them. the tolerance starts
+ * at about a pixel, at the closest the camera gets. a point that earlier
+ * passes left at a finer level only gets what those didn't use up, so it
+ * stays within the tolerance of where it started, and points already at
+ * level are kept. a chunk's level is the coarsest of its points. returns
+ * how many chunks the points now take. */
+static inline size_t lorenz_decimate(struct lorenz *l, size_t span,
+                                     uint8_t level) {
+	size_t i, j, n, num, k = 0, out = 0;
+	struct point_hue run[LORENZ_RUN], p;
+	uint8_t lv[LORENZ_RUN], from;
+	struct point_bucket *b;
+	float slack[LORENZ_LEVELS + 1], tol;
+	for(j = 0; j <= LORENZ_LEVELS; j++) {
+		tol = MAX(lorenz_tol(l, level) - lorenz_tol(l, j), 0);
+		slack[j] = tol * tol;
+	}
+	/* output never overtakes input, and the chunk being read is only
+	 * written at or before the point just read, so num and its level are
+	 * read first */
+	for(i = 0; i < span; i++) {
+		b = lorenz_chunk(l, i);
+		num = b->num;
+		from = b->level;
+		for(n = 0; n < num; n++) {
+			p = (struct point_hue){ { b->x[n], b->y[n], b->z[n] },
+			                        b->hue[n] };
+			for(j = 1; j < k; j++)
+				if(segment_dist2(run[0].p, p.p, run[j].p) > slack[lv[j]])
+					break;
+			if(k < 2 || (j == k && k < LORENZ_RUN)) {
+				lv[k] = from;
+				run[k++] = p;
+				continue;
+			}
+			lorenz_put(l, out++, run[0], MAX(lv[0], level));
+			run[0] = run[k - 1];
+			lv[0] = lv[k - 1];
+			run[1] = p;
+			lv[1] = from;
+			k = 2;
+		}
+	}
+	for(j = 0; j < k; j += MAX(k - 1, 1))
+		lorenz_put(l, out++, run[j], MAX(lv[j], level));
+	return (out + LORENZ_CHUNK - 1) / LORENZ_CHUNK;
+}
+
+/* make room by decimating the older half of the ring, one level coarser
+ * than the newest chunk of it, and coarser still until an eighth of the
+ * ring is free. past the last level, the oldest chunks are dropped for
+ * what's missing. */
+static inline void lorenz_compact(struct lorenz *l) {
+	size_t span = l->count / 2, goal = MAX(l->count / 8, 1), freed, i, n;
+	uint8_t level = MIN(lorenz_chunk(l, span - 1)->level + 1,
+	                    LORENZ_LEVELS);
+	n = lorenz_decimate(l, span, level);
+	while(span - n < goal && level < LORENZ_LEVELS)
+		n = lorenz_decimate(l, n, ++level);
+	// move what's left up against the newer half
+	freed = span - n;
+	for(i = n; i > 0 && freed > 0; i--)
+		*lorenz_chunk(l, freed + i - 1) = *lorenz_chunk(l, i - 1);
+	freed = MAX(freed, goal);
+	l->head = (l->head + freed) % l->num_chunks;
+	l->count -= freed;
+	l->compactions++;
+	l->redraw = 1;
+}
+
+static inline void lorenz_append(struct lorenz *l, struct point3d p) {
+	struct point_bucket *b = lorenz_chunk(l, l->count - 1);
+	if(b->num >= LORENZ_CHUNK) {
+		if(l->count == l->num_chunks)
+			lorenz_compact(l);
+		b = lorenz_chunk(l, l->count++);
+		b->num = 0;
+		b->level = 0;
+	}
+	b->x[b->num] = p.x;
+	b->y[b->num] = p.y;
+	b->z[b->num] = p.z;
+	l->hue = (l->hue + 1) % LORENZ_RAMP;
+	b->hue[b->num++] = l->hue;
+}
+
+// draw the segment from tail to p, on screen, in p's colour
+static inline void lorenz_segment(struct lorenz *l, struct point2d p,
+                                  uint16_t hue) {
+	cgbp_raster_line(&l->raster, cgbp_raster_rect(&l->raster), l->tail.x,
+	                 l->tail.y, p.x, p.y, l->ramp[hue]);
+	l->tail = p;
+}
+
+// which of n tiles of a row or column pixel p falls in
+static inline int16_t lorenz_tile(long p, size_t len, size_t n) {
+	return p < 0 ? -1 : p >= (long)len ? (long)n : p / LORENZ_TILE;
+}
+
+static void lorenz_project_chunk(void *data, size_t i, size_t worker) {
+	struct lorenz *l = data;
+	const struct point_bucket *b = lorenz_chunk(l, i);
+	size_t j, start = l->chunk_start[i];
+	lorenz_project(&l->xf, b->x, b->y, b->z, l->sx + start, l->sy + start,
+	               b->num);
+	memcpy(l->shue + start, b->hue, b->num * sizeof *b->hue);
+	for(j = start; j < start + b->num; j++) {
+		l->stx[j] = lorenz_tile(l->sx[j], l->raster.w, l->tiles_w);
+		l->sty[j] = lorenz_tile(l->sy[j], l->raster.h, l->tiles_h);
+	}
+	(void)worker;
 }
 
-static inline int lorenz_append(struct lorenz *l, struct point3d *p) {
-	if(l->last->num >= ARRAY_LENGTH(l->last->p)) {
-		l->last->next = malloc(sizeof *l->last->next);
-		if(l->last->next == NULL) {
-			perror("malloc");
+// the tiles a segment's box crosses; tile order is pixel order
+static inline int lorenz_segment_tiles(const struct lorenz *l, size_t i,
+                                       struct cgbp_rect *r) {
+	size_t a = i ? i - 1 : 0;
+	*r = (struct cgbp_rect){
+		MAX(MIN(l->stx[a], l->stx[i]), 0), MAX(MIN(l->sty[a], l->sty[i]), 0),
+		MIN(MAX(l->stx[a], l->stx[i]) + 1, (long)l->tiles_w),
+		MIN(MAX(l->sty[a], l->sty[i]) + 1, (long)l->tiles_h),
+	};
+	return r->x0 < r->x1 && r->y0 < r->y1;
+}
+
+/* count the segments of a worker's range into its row of tile_fill, or
+ * with fill set, list them from its cursors there */
+static inline void lorenz_bin_range(struct lorenz *l, size_t task, int fill) {
+	size_t tiles = l->tiles_w * l->tiles_h, i, t,
+	       i1 = (task + 1) * l->num_segs / l->pool.size;
+	uint32_t *cursor = l->tile_fill + task * tiles;
+	struct cgbp_rect r;
+	long tx, ty;
+	if(!fill)
+		memset(cursor, 0, tiles * sizeof *cursor);
+	for(i = task * l->num_segs / l->pool.size; i < i1; i++) {
+		if(!lorenz_segment_tiles(l, i, &r))
+			continue;
+		for(ty = r.y0; ty < r.y1; ty++)
+			for(tx = r.x0; tx < r.x1; tx++) {
+				t = ty * l->tiles_w + tx;
+				if(fill)
+					l->tile_segs[cursor[t]++] = i;
+				else
+					cursor[t]++;
+			}
+	}
+}
+
+static void lorenz_bin_count(void *data, size_t task, size_t worker) {
+	lorenz_bin_range(data, task, 0);
+	(void)worker;
+}
+
+static void lorenz_bin_fill(void *data, size_t task, size_t worker) {
+	lorenz_bin_range(data, task, 1);
+	(void)worker;
+}
+
+/* list the segments by the tiles their boxes cross, keeping their order:
+ * a tile's list takes each range's segments in turn */
+static inline int lorenz_bin(struct lorenz *l, size_t num) {
+	size_t tiles = l->tiles_w * l->tiles_h, t, k;
+	uint32_t *tile_segs, count, sum = 0;
+	l->num_segs = num;
+	cgbp_pool_run(&l->pool, l->pool.size, lorenz_bin_count, l);
+	for(t = 0; t < tiles; t++) {
+		l->tile_start[t] = sum;
+		for(k = 0; k < l->pool.size; k++) {
+			count = l->tile_fill[k * tiles + t];
+			l->tile_fill[k * tiles + t] = sum;
+			sum += count;
+		}
+	}
+	l->tile_start[tiles] = sum;
+	if(sum > l->tile_segs_len) {
+		tile_segs = realloc(l->tile_segs, sum * sizeof *l->tile_segs);
+		if(tile_segs == NULL) {
+			perror("realloc");
 			return -1;
 		}
-		l->last = l->last->next;
-		l->last->num = 0;
-		l->last->next = NULL;
+		l->tile_segs = tile_segs;
+		l->tile_segs_len = sum;
 	}
-	l->last->p[l->last->num++] = *p;
+	cgbp_pool_run(&l->pool, l->pool.size, lorenz_bin_fill, l);
 	return 0;
 }
 
-static inline struct point3d scale(float scale, struct point3d p) {
-	return (struct point3d){ p.x / scale, p.y / scale, p.z / scale };
+// clear a tile, then draw the box and its segments clipped to it
+static void lorenz_draw_tile(void *data, size_t t, size_t worker) {
+	struct lorenz *l = data;
+	long tx = t % l->tiles_w * LORENZ_TILE, ty = t / l->tiles_w * LORENZ_TILE;
+	struct cgbp_rect clip = {
+		tx, ty, tx + LORENZ_TILE, ty + LORENZ_TILE,
+	};
+	size_t i, j;
+	cgbp_raster_fill(&l->raster, clip, 0xff000000);
+	draw_bounding_box(&l->raster, clip, &l->c);
+	for(i = l->tile_start[t]; i < l->tile_start[t + 1]; i++) {
+		j = l->tile_segs[i];
+		cgbp_raster_line(&l->raster, clip, l->sx[j ? j - 1 : 0],
+		                 l->sy[j ? j - 1 : 0], l->sx[j], l->sy[j],
+		                 l->ramp[l->shue[j]]);
+	}
+	(void)worker;
 }
 
-#define CENTERX(x, s) (x + (s).w / 2)
-#define CENTERY(y, s) ((s).h / 2 - y)
-static inline void lorenz_draw(struct cgbp *c, struct cgbp_size size,
-                               struct lorenz *l) {
-	struct point2d new, old;
-	struct point_bucket *cur;
-	double rgb[3] = { 0 }, h = 0;
+static inline void lorenz_draw_all(struct lorenz *l, size_t n) {
+	struct cgbp_rect clip = cgbp_raster_rect(&l->raster);
 	size_t i;
-	old = cam_vt(&l->c, scale(l->maxext, l->bucket.p[0]));
-	for(cur = &l->bucket; cur != NULL; cur = cur->next) {
-		if(cur->num == 0)
-			continue;
-		for(i = 0; i < cur->num; i++) {
-			new = cam_vt(&l->c, scale(l->maxext, cur->p[i]));
-			h += .001;
-			while(h > 1) h -= 1;
-			hsv_to_rgb(rgb, h, 1, 1);
-			draw_line(c, size, CENTERX(old.x, size), CENTERY(old.y, size),
-			          CENTERX(new.x, size), CENTERY(new.y, size),
-			          TO_RGB(rgb[0] * 0xff, rgb[1] * 0xff, rgb[2] * 0xff));
-			old = new;
+	cgbp_raster_clear(&l->raster, 0xff000000);
+	draw_bounding_box(&l->raster, clip, &l->c);
+	for(i = 0; i < n; i++)
+		cgbp_raster_line(&l->raster, clip, l->sx[i ? i - 1 : 0],
+		                 l->sy[i ? i - 1 : 0], l->sx[i], l->sy[i],
+		                 l->ramp[l->shue[i]]);
+}
+
+/* draw the box and the whole trajectory again from the start: project
+ * every chunk, bin the segments by tile and draw the tiles, across the
+ * pool; only the prefix sum over the tile lists runs on the calling
+ * thread. a pool of one draws it all as one tile. */
+static inline int lorenz_draw(struct lorenz *l, struct cgbp_size size) {
+	uint32_t *raster, *tile_start, *tile_fill;
+	size_t i, n;
+	if(l->raster.data == NULL || size.w != l->raster.w ||
+	  size.h != l->raster.h) {
+		l->tiles_w = (size.w + LORENZ_TILE - 1) / LORENZ_TILE;
+		l->tiles_h = (size.h + LORENZ_TILE - 1) / LORENZ_TILE;
+		n = l->tiles_w * l->tiles_h;
+		raster = realloc(l->raster.data, size.w * size.h * sizeof *raster);
+		if(raster != NULL)
+			l->raster.data = raster;
+		tile_start = realloc(l->tile_start, (n + 1) * sizeof *tile_start);
+		if(tile_start != NULL)
+			l->tile_start = tile_start;
+		tile_fill = realloc(l->tile_fill,
+		                    n * l->pool.size * sizeof *tile_fill);
+		if(tile_fill != NULL)
+			l->tile_fill = tile_fill;
+		if(raster == NULL || tile_start == NULL || tile_fill == NULL) {
+			perror("realloc");
+			return -1;
 		}
+		l->raster = (struct cgbp_raster){ raster, size.w, size.h, size.w };
+	}
+	xform_init(&l->xf, &l->c, l->maxext, size);
+	for(i = n = 0; i < l->count; i++) {
+		l->chunk_start[i] = n;
+		n += lorenz_chunk(l, i)->num;
 	}
+	cgbp_pool_run(&l->pool, l->count, lorenz_project_chunk, l);
+	if(l->pool.size > 1) {
+		if(lorenz_bin(l, n) < 0)
+			return -1;
+		cgbp_pool_run(&l->pool, l->tiles_w * l->tiles_h, lorenz_draw_tile,
+		              l);
+	} else
+		lorenz_draw_all(l, n);
+	l->tail = (struct point2d){ l->sx[n - 1], l->sy[n - 1] };
+	l->redraw = 0;
+	return 0;
 }
 
-int lorenz_update(struct cgbp *c, void *data) {
-	struct lorenz *l = data;
-	struct cgbp_size size = driver.size(c);
-	struct point3d o, param = { 10., 28., 8. / 3. }, d;
+// copy the raster out, by rows where the framebuffer is 32 bit
+static inline void lorenz_present(const struct lorenz *l,
+                                  const struct cgbp_fb *fb) {
+	const struct cgbp_raster *r = &l->raster;
 	size_t x, y;
-	for(y = 0; y < size.h; y++)
-		for(x = 0; x < size.w; x++)
-			driver.set_pixel(c, x, y, 0);
-	draw_bounding_box(c, size, &l->c);
-	if(l->last->num == 0)
+	for(y = 0; y < r->h; y++)
+		switch(CGBP_FB_FORMAT(fb)) {
+		case CGBP_FORMAT_XRGB8888:
+		case CGBP_FORMAT_ARGB8888:
+			memcpy(cgbp_fb_row(fb, y), r->data + y * r->stride,
+			       r->w * sizeof *r->data);
+			break;
+		default:
+			for(x = 0; x < r->w; x++)
+				cgbp_fb_set_pixel(fb, x, y, r->data[y * r->stride + x]);
+			break;
+		}
+}
+
+static inline char lorenz_move(struct lorenz *l, char r) {
+	char cammove = 0;
+	if(r == 'w' || r == 'W')
+		l->c.dist = MAX(2.5, l->c.dist - .1), cammove = 1;
+	if(r == 's' || r == 'S')
+		l->c.dist = MIN(8, l->c.dist + .1), cammove = 1;
+	if(r == 'a' || r == 'A')
+		l->c.rotxz += M_PI / 180, cammove = 1;
+	if(r == 'd' || r == 'D')
+		l->c.rotxz -= M_PI / 180, cammove = 1;
+	return cammove;
+}
+
+// move the camera for as long as keys are held, if the driver can tell us
+static inline void lorenz_poll_keys(struct cgbp *c, struct lorenz *l) {
+	const char *k;
+	char cammove = 0;
+	for(k = "wasd"; *k != '\0'; k++)
+		if(cgbp_key_pressed(c, *k) == 1)
+			cammove |= lorenz_move(l, *k);
+	if(cammove) {
+		cam_updatepos(&l->c);
+		l->redraw = 1;
+	}
+}
+
+int lorenz_action(struct cgbp *c, void *data, char r) {
+	struct lorenz *l = data;
+	if(r == 'q' || r == 'Q')
+		c->running = 0;
+	// held keys are handled by lorenz_poll_keys instead
+	if(cgbp_key_pressed(c, r) < 0 && lorenz_move(l, r)) {
+		cam_updatepos(&l->c);
+		l->redraw = 1;
+	}
+	return 0;
+}
+
+// integrate one more point; a new extent rescales everything drawn
+static inline void lorenz_step(struct lorenz *l) {
+	struct point3d o, v, d;
+	const struct point_bucket *b = lorenz_chunk(l, l->count - 1);
+	float maxext = l->maxext;
+	if(b->num == 0)
 		o = (struct point3d){ -9.229547, -9.023968, 28.181185 };
 	else
-		o = l->last->p[l->last->num - 1];
-	d.x = o.x + param.x * (o.y - o.x) * l->dt;
-	d.y = o.y + (o.x * (param.y - o.z) - o.y) * l->dt;
-	d.z = o.z + (o.x * o.y - param.z * o.z) * l->dt;
+		o = (struct point3d){
+			b->x[b->num - 1], b->y[b->num - 1], b->z[b->num - 1],
+		};
+	v = lorenz_velocity(o);
+	d.x = o.x + v.x * l->dt;
+	d.y = o.y + v.y * l->dt;
+	d.z = o.z + v.z * l->dt;
 	if(fabsf(d.x) > l->maxext)
 		l->maxext = fabsf(d.x);
 	if(fabsf(d.y) > l->maxext)
 		l->maxext = fabsf(d.y);
 	if(fabsf(d.z) > l->maxext)
 		l->maxext = fabsf(d.z);
-	if(lorenz_append(l, &d) < 0)
+	if(l->maxext != maxext)
+		l->redraw = 1;
+	lorenz_append(l, d);
+}
+
+static inline int lorenz_frame(struct lorenz *l, struct cgbp_size size,
+                               const struct cgbp_fb *fb) {
+	const struct point_bucket *b;
+	lorenz_step(l);
+	if(l->redraw || l->raster.data == NULL || size.w != l->raster.w ||
+	  size.h != l->raster.h) {
+		if(lorenz_draw(l, size) < 0)
+			return -1;
+	} else {
+		b = lorenz_chunk(l, l->count - 1);
+		lorenz_segment(l, xform_apply(&l->xf, b->x[b->num - 1],
+		                              b->y[b->num - 1], b->z[b->num - 1]),
+		               b->hue[b->num - 1]);
+	}
+	lorenz_present(l, fb);
+	return 0;
+}
+
+// density planes and tone mapped lines for the screen size
+static inline int lorenz_cloud_resize(struct lorenz_cloud *cl,
+                                      struct cgbp_size size) {
+	free(cl->density);
+	free(cl->lines);
+	cl->size = size;
+	cl->density = calloc(size.w * size.h * cl->planes,
+	                     sizeof *cl->density);
+	cl->lines = malloc(size.w * cl->planes * sizeof *cl->lines);
+	if(cl->density == NULL || cl->lines == NULL) {
+		perror("malloc");
 		return -1;
-	lorenz_draw(c, size, l);
+	}
 	return 0;
 }
 
-int lorenz_action(struct cgbp *c, void *data, char r) {
+/* seed num particles in a small cube about where the trajectory starts,
+ * after lorenz_init */
+static inline int lorenz_cloud_init(struct lorenz *l, size_t num) {
+	struct lorenz_cloud *cl = &l->cloud;
+	size_t i;
+	double rgb[3] = { 0 }, t;
+	cl->num = num;
+	cl->planes = l->pool.size;
+	cl->x = malloc(num * sizeof *cl->x);
+	cl->y = malloc(num * sizeof *cl->y);
+	cl->z = malloc(num * sizeof *cl->z);
+	cl->sx = malloc(LORENZ_CHUNK * cl->planes * sizeof *cl->sx);
+	cl->sy = malloc(LORENZ_CHUNK * cl->planes * sizeof *cl->sy);
+	if(cl->x == NULL || cl->y == NULL || cl->z == NULL || cl->sx == NULL ||
+	  cl->sy == NULL) {
+		perror("malloc");
+		return -1;
+	}
+#define SEED(c) ((c) + ((float)rand() / RAND_MAX - .5) * LORENZ_SPREAD)
+	for(i = 0; i < num; i++) {
+		cl->x[i] = SEED(-9.229547);
+		cl->y[i] = SEED(-9.023968);
+		cl->z[i] = SEED(28.181185);
+	}
+#undef SEED
+	// from dim blue through to white
+	for(i = 0; i < ARRAY_LENGTH(cl->palette); i++) {
+		t = (double)i / (ARRAY_LENGTH(cl->palette) - 1);
+		hsv_to_rgb(rgb, .66 - .5 * t, 1 - t * t, t);
+		cl->palette[i] = 0xff000000 |
+		                 TO_RGB(rgb[0] * 0xff, rgb[1] * 0xff, rgb[2] * 0xff);
+	}
+	for(i = 0; i < CGBP_POOL_MAX; i++)
+		cl->peak[i] = 1;
+	return 0;
+}
+
+static void lorenz_cloud_step(void *data, size_t task, size_t worker) {
 	struct lorenz *l = data;
-	char cammove = 0;
-	if(r == 'q' || r == 'Q')
-		c->running = 0;
-	if(r == 'w' || r == 'W')
-		l->c.dist = MAX(2.5, l->c.dist - .1), cammove = 1;
-	if(r == 's' || r == 'S')
-		l->c.dist = MIN(8, l->c.dist + .1), cammove = 1;
-	if(r == 'a' || r == 'A')
-		l->c.rotxz += M_PI / 180, cammove = 1;
-	if(r == 'd' || r == 'D')
-		l->c.rotxz -= M_PI / 180, cammove = 1;
-	if(cammove)
-		cam_updatepos(&l->c);
+	struct lorenz_cloud *cl = &l->cloud;
+	size_t i = task * LORENZ_CHUNK, n = MIN(cl->num - i, LORENZ_CHUNK), j;
+	float *sx = cl->sx + worker * LORENZ_CHUNK;
+	float *sy = cl->sy + worker * LORENZ_CHUNK;
+	uint32_t *density = cl->density + worker * cl->size.w * cl->size.h;
+	long x, y;
+	lorenz_rk4(cl->x + i, cl->y + i, cl->z + i, n, l->dt, LORENZ_SUBSTEPS);
+	lorenz_project(&cl->xf, cl->x + i, cl->y + i, cl->z + i, sx, sy, n);
+	for(j = 0; j < n; j++) {
+		// behind the camera comes out negative or nan, and fails here
+		if(!(sx[j] >= 0 && sx[j] < cl->size.w &&
+		  sy[j] >= 0 && sy[j] < cl->size.h))
+			continue;
+		x = sx[j];
+		y = sy[j];
+		density[y * cl->size.w + x]++;
+	}
+}
+
+static void lorenz_cloud_band(void *data, size_t band, size_t worker) {
+	struct lorenz_cloud *cl = data;
+	const struct cgbp_fb *fb = cl->out;
+	size_t w = cl->size.w, y = band * LORENZ_BAND, x,
+	       y1 = MIN(y + LORENZ_BAND, cl->size.h);
+	uint32_t *line = cl->lines + worker * w;
+	int direct = CGBP_FB_FORMAT(fb) == CGBP_FORMAT_XRGB8888 ||
+	             CGBP_FB_FORMAT(fb) == CGBP_FORMAT_ARGB8888;
+	for(; y < y1; y++) {
+		lorenz_tone_row(direct ? (uint32_t *)cgbp_fb_row(fb, y) : line,
+		                cl->density + y * w, cl->planes,
+		                w * cl->size.h, cl->tone, &cl->peak[worker], w);
+		if(!direct)
+			for(x = 0; x < w; x++)
+				cgbp_fb_set_pixel(fb, x, y, line[x]);
+	}
+}
+
+/* integrate and count the particles, then tone map log density so the
+ * previous frame's peak is white */
+static inline int lorenz_cloud_frame(struct lorenz *l, struct cgbp_size size,
+                                     const struct cgbp_fb *fb) {
+	struct lorenz_cloud *cl = &l->cloud;
+	uint32_t peak = 1;
+	size_t i;
+	if((cl->density == NULL || size.w != cl->size.w ||
+	  size.h != cl->size.h) && lorenz_cloud_resize(cl, size) < 0)
+		return -1;
+	for(i = 0; i < cl->planes; i++) {
+		peak = MAX(peak, cl->peak[i]);
+		cl->peak[i] = 0;
+	}
+	for(i = 0; i < LORENZ_TONE; i++)
+		cl->tone[i] = cl->palette[(size_t)(MIN(log1p(i) / log1p(peak), 1) *
+		                                   (ARRAY_LENGTH(cl->palette) - 1))];
+	xform_init(&cl->xf, &l->c, LORENZ_EXTENT, size);
+	cl->out = fb;
+	cgbp_pool_run(&l->pool, (cl->num + LORENZ_CHUNK - 1) / LORENZ_CHUNK,
+	              lorenz_cloud_step, l);
+	cgbp_pool_run(&l->pool, (size.h + LORENZ_BAND - 1) / LORENZ_BAND,
+	              lorenz_cloud_band, cl);
 	return 0;
 }
 
+int lorenz_update(struct cgbp *c, void *data) {
+	struct lorenz *l = data;
+	struct cgbp_fb fb = c->fb;
+	lorenz_poll_keys(c, l);
+	if(l->cloud.num > 0)
+		return lorenz_cloud_frame(l, driver.size(c), &fb);
+	return lorenz_frame(l, driver.size(c), &fb);
+}
+
 void lorenz_cleanup(struct lorenz *l) {
-	struct point_bucket *b = l->bucket.next;
-	while(b != NULL) {
-		l->last = b->next;
-		free(b);
-		b = l->last;
+	struct lorenz_cloud *cl = &l->cloud;
+	free(l->raster.data);
+	l->raster = (struct cgbp_raster){ NULL, 0, 0, 0 };
+	free(l->chunks);
+	l->chunks = NULL;
+	free(l->chunk_start);
+	free(l->sx);
+	free(l->sy);
+	free(l->shue);
+	free(l->stx);
+	free(l->sty);
+	free(l->tile_start);
+	free(l->tile_fill);
+	free(l->tile_segs);
+	l->chunk_start = NULL;
+	l->sx = l->sy = NULL;
+	l->shue = NULL;
+	l->stx = l->sty = NULL;
+	l->tile_start = l->tile_fill = l->tile_segs = NULL;
+	free(cl->x);
+	free(cl->y);
+	free(cl->z);
+	free(cl->sx);
+	free(cl->sy);
+	free(cl->density);
+	free(cl->lines);
+	*cl = (struct lorenz_cloud){ .num = 0 };
+	cgbp_pool_cleanup(&l->pool);
+}
+
+#define LORENZ_BENCH_FRAMES 16
+
+/* CGBP_BENCH: time of drawing everything again, as a camera move does,
+ * against a frame that only adds a segment, as history grows past the
+ * memory cap */
+static int lorenz_bench_history(double mib) {
+	static const struct cgbp_size size = { 1920, 1080 };
+	static const size_t lengths[] = {
+		1000, 10000, 100000, 1000000, 10000000,
+	};
+	struct lorenz l = {
+		.c = {
+			.rotxz = 0, .rotyz = 0, .fac = MIN(size.w, size.h),
+			.pos = { 0, .75, -5 },
+			.dist = 5,
+		},
+		.dt = .01,
+	};
+	struct cgbp_fb fb = {
+		NULL, NULL, size.w, size.h, size.w * 4, CGBP_FORMAT_XRGB8888,
+	};
+	size_t i, k, n = 0, kept;
+	double start, redraw;
+	int ret = -1;
+	fb.data = malloc(fb.stride * fb.h);
+	if(fb.data == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	if(lorenz_init(&l, mib, 0) < 0)
+		goto error;
+	cam_updatepos(&l.c);
+	lorenz_ramp(l.ramp);
+	fprintf(stderr, "%zux%zu, %g MiB: %zu chunks of %zu points\n"
+	        "%8s %8s %5s %11s %10s %9s\n", size.w, size.h, mib,
+	        l.num_chunks, (size_t)LORENZ_CHUNK, "points", "kept", "level",
+	        "compactions", "redraw ms", "ms/frame");
+	for(i = 0; i < ARRAY_LENGTH(lengths); i++) {
+		for(; n < lengths[i]; n++)
+			lorenz_step(&l);
+		start = cgbp_time();
+		if(lorenz_draw(&l, size) < 0)
+			goto error;
+		lorenz_present(&l, &fb);
+		redraw = cgbp_time() - start;
+		start = cgbp_time();
+		for(k = 0; k < LORENZ_BENCH_FRAMES; k++, n++)
+			if(lorenz_frame(&l, size, &fb) < 0)
+				goto error;
+		redraw *= 1e3;
+		start = (cgbp_time() - start) * 1e3 / LORENZ_BENCH_FRAMES;
+		for(k = kept = 0; k < l.count; k++)
+			kept += lorenz_chunk(&l, k)->num;
+		fprintf(stderr, "%8zu %8zu %5d %11zu %10.2f %9.3f\n", n, kept,
+		        lorenz_chunk(&l, 0)->level, l.compactions, redraw, start);
+	}
+	ret = 0;
+error:
+	free(fb.data);
+	lorenz_cleanup(&l);
+	return ret;
+}
+
+// redraw time of a long trajectory over thread counts
+static int lorenz_bench_draw(void) {
+	static const struct cgbp_size size = { 1920, 1080 };
+	static const size_t length = 1000000;
+	struct lorenz l;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t k, threads, max = cpus > 0 ? (size_t)cpus : 1;
+	double start, elapsed;
+	fprintf(stderr, "%zux%zu, %zu points\n%7s %10s %10s\n", size.w, size.h,
+	        length, "threads", "redraw ms", "per thread");
+	for(threads = 1; threads <= max; threads =
+	  threads < max && threads * 2 > max ? max : threads * 2) {
+		l = (struct lorenz){
+			.c = {
+				.rotxz = 0, .rotyz = 0, .fac = MIN(size.w, size.h),
+				.pos = { 0, .75, -5 },
+				.dist = 5,
+			},
+			.dt = .01,
+		};
+		if(lorenz_init(&l, LORENZ_MEMORY, threads) < 0) {
+			lorenz_cleanup(&l);
+			return -1;
+		}
+		cam_updatepos(&l.c);
+		lorenz_ramp(l.ramp);
+		for(k = 0; k < length; k++)
+			lorenz_step(&l);
+		// the first allocates
+		if(lorenz_draw(&l, size) < 0) {
+			lorenz_cleanup(&l);
+			return -1;
+		}
+		start = cgbp_time();
+		for(k = 0; k < LORENZ_BENCH_FRAMES; k++)
+			if(lorenz_draw(&l, size) < 0) {
+				lorenz_cleanup(&l);
+				return -1;
+			}
+		elapsed = (cgbp_time() - start) * 1e3 / LORENZ_BENCH_FRAMES;
+		fprintf(stderr, "%7zu %10.2f %10.2f\n", threads, elapsed,
+		        elapsed * threads);
+		lorenz_cleanup(&l);
+	}
+	return 0;
+}
+
+// the division per pixel line drawing from before cgbp_raster_line
+static void lorenz_bench_line_ref(const struct cgbp_raster *r,
+                                  struct cgbp_rect clip, long start_x,
+                                  long start_y, long end_x, long end_y,
+                                  uint32_t color) {
+	long delta_x, delta_y, pos, other, lo, hi;
+	delta_x = end_x - start_x;
+	delta_y = end_y - start_y;
+	if(end_x >= clip.x0 && end_x < clip.x1 &&
+	  end_y >= clip.y0 && end_y < clip.y1)
+		r->data[end_y * r->stride + end_x] = color;
+	if(ABS(delta_x) < ABS(delta_y))
+		goto use_y;
+	lo = MAX(delta_x > 0 ? start_x : end_x + 1, clip.x0);
+	hi = MIN(delta_x > 0 ? end_x - 1 : start_x, clip.x1 - 1);
+	for(pos = lo; pos <= hi; pos++) {
+		other = start_y + delta_y * ABS(pos - start_x) / ABS(delta_x);
+		if(other >= clip.y0 && other < clip.y1)
+			r->data[other * r->stride + pos] = color;
+	}
+	return;
+use_y:
+	lo = MAX(delta_y > 0 ? start_y : end_y + 1, clip.y0);
+	hi = MIN(delta_y > 0 ? end_y - 1 : start_y, clip.y1 - 1);
+	for(pos = lo; pos <= hi; pos++) {
+		other = start_x + delta_x * ABS(pos - start_y) / ABS(delta_y);
+		if(other >= clip.x0 && other < clip.x1)
+			r->data[pos * r->stride + other] = color;
 	}
 }
 
+/* random segments of a few lengths, a quarter of them crossing the edge,
+ * drawn with cgbp_raster_line against the routine it replaced. both draw
+ * the same pixels; differ counts any that don't. */
+static int lorenz_bench_lines(void) {
+	static const struct cgbp_size size = { 1920, 1080 };
+	static const long lengths[] = { 4, 64, 1024 };
+	struct cgbp_raster r[2];
+	struct cgbp_rect clip = { 0, 0, size.w, size.h };
+	long *seg, len;
+	size_t i, k, n = 100000, differ;
+	double start, elapsed[2];
+	int ret = -1;
+	seg = malloc(n * 4 * sizeof *seg);
+	for(k = 0; k < 2; k++)
+		r[k] = (struct cgbp_raster){
+			calloc(size.w * size.h, sizeof *r[k].data),
+			size.w, size.h, size.w,
+		};
+	if(seg == NULL || r[0].data == NULL || r[1].data == NULL) {
+		perror("malloc");
+		goto error;
+	}
+	fprintf(stderr, "%zux%zu, %zu lines\n%6s %10s %10s %7s %6s\n", size.w,
+	        size.h, n, "length", "ref Mpx/s", "new Mpx/s", "speedup",
+	        "differ");
+	// touch every page before timing
+	cgbp_raster_clear(&r[0], 0);
+	cgbp_raster_clear(&r[1], 0);
+	srand(1);
+	for(i = 0; i < ARRAY_LENGTH(lengths); i++) {
+		len = lengths[i];
+		for(k = 0; k < n; k++) {
+			seg[k * 4] = rand() % (size.w + (k % 4 ? 0 : 2 * len)) -
+			             (k % 4 ? 0 : len);
+			seg[k * 4 + 1] = rand() % (size.h + (k % 4 ? 0 : 2 * len)) -
+			                 (k % 4 ? 0 : len);
+			seg[k * 4 + 2] = seg[k * 4] + rand() % (2 * len + 1) - len;
+			seg[k * 4 + 3] = seg[k * 4 + 1] + rand() % (2 * len + 1) - len;
+		}
+		start = cgbp_time();
+		for(k = 0; k < n; k++)
+			lorenz_bench_line_ref(&r[0], clip, seg[k * 4], seg[k * 4 + 1],
+			                      seg[k * 4 + 2], seg[k * 4 + 3], k);
+		elapsed[0] = cgbp_time() - start;
+		start = cgbp_time();
+		for(k = 0; k < n; k++)
+			cgbp_raster_line(&r[1], clip, seg[k * 4], seg[k * 4 + 1],
+			                 seg[k * 4 + 2], seg[k * 4 + 3], k);
+		elapsed[1] = cgbp_time() - start;
+		for(k = differ = 0; k < size.w * size.h; k++)
+			differ += r[0].data[k] != r[1].data[k];
+		// pixels along the major axis, about two thirds of len
+		fprintf(stderr, "%6ld %10.1f %10.1f %7.2f %6zu\n", len,
+		        n * len * 2 / 3. / elapsed[0] / 1e6,
+		        n * len * 2 / 3. / elapsed[1] / 1e6,
+		        elapsed[0] / elapsed[1], differ);
+	}
+	ret = 0;
+error:
+	free(seg);
+	free(r[0].data);
+	free(r[1].data);
+	return ret;
+}
+
+/* particle steps per second over particle and thread counts, stepping and
+ * drawing, as of the frame */
+static int lorenz_bench_cloud(void) {
+	static const struct cgbp_size size = { 1920, 1080 };
+	static const size_t counts[] = { 10000, 100000, 1000000 };
+	struct lorenz l;
+	struct cgbp_fb fb = {
+		NULL, NULL, size.w, size.h, size.w * 4, CGBP_FORMAT_XRGB8888,
+	};
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t i, k, threads, max = cpus > 0 ? (size_t)cpus : 1;
+	double start, elapsed, rate;
+	int ret = -1;
+	fb.data = malloc(fb.stride * fb.h);
+	if(fb.data == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	fprintf(stderr, "%zux%zu, %d rk4 steps per frame\n%9s %7s %9s %11s "
+	        "%10s\n", size.w, size.h, LORENZ_SUBSTEPS, "particles",
+	        "threads", "ms/frame", "Msteps/s", "per thread");
+	for(i = 0; i < ARRAY_LENGTH(counts); i++)
+		for(threads = 1; threads <= max; threads =
+		  threads < max && threads * 2 > max ? max : threads * 2) {
+			srand(1);
+			l = (struct lorenz){
+				.c = {
+					.rotxz = 0, .rotyz = 0, .fac = MIN(size.w, size.h),
+					.pos = { 0, .75, -5 },
+					.dist = 5,
+				},
+				.dt = .01,
+			};
+			cam_updatepos(&l.c);
+			if(lorenz_init(&l, 0, threads) < 0 ||
+			  lorenz_cloud_init(&l, counts[i]) < 0 ||
+			  lorenz_cloud_frame(&l, size, &fb) < 0)
+				goto error;
+			start = cgbp_time();
+			for(k = 0; k < LORENZ_BENCH_FRAMES; k++)
+				if(lorenz_cloud_frame(&l, size, &fb) < 0)
+					goto error;
+			elapsed = (cgbp_time() - start) / LORENZ_BENCH_FRAMES;
+			rate = counts[i] * LORENZ_SUBSTEPS / elapsed / 1e6;
+			fprintf(stderr, "%9zu %7zu %9.2f %11.1f %10.1f\n", counts[i],
+			        threads, elapsed * 1e3, rate, rate / threads);
+			lorenz_cleanup(&l);
+		}
+	ret = 0;
+error:
+	lorenz_cleanup(&l);
+	free(fb.data);
+	return ret;
+}
+
+int lorenz_bench(double mib) {
+	if(cgbp_kernels_init() < 0 || lorenz_bench_lines() < 0 ||
+	  lorenz_bench_history(mib) < 0 || lorenz_bench_draw() < 0 ||
+	  lorenz_bench_cloud() < 0)
+		return -1;
+	return 0;
+}
+
 int main(void) {
 	struct lorenz l = {
 		.c = {
@@ -227,19 +1151,30 @@ int main(void) {
 			.dist = 5,
 		},
 		.dt = .01,
-		.bucket = {
-			.p = { { 0, 0, 0 } },
-			.num = 0,
-			.next = NULL,
-		},
-		.last = &l.bucket,
+		.chunks = NULL,
 	};
 	struct cgbp c;
 	struct cgbp_size size = { 0 };
-	int ret;
-	if(cgbp_init(&c) < 0)
+	const char *env = getenv("LORENZ_MEMORY");
+	double mib = LORENZ_MEMORY;
+	size_t particles = 0;
+	int ret = EXIT_FAILURE;
+	// so its worth of bytes still fits a size_t
+	if(env != NULL && (!isfinite(mib = strtod(env, NULL)) || mib <= 0 ||
+	  mib > SIZE_MAX >> 20)) {
+		fprintf(stderr, "Error: LORENZ_MEMORY: expected a positive size in "
+		        "MiB.\n");
+		return EXIT_FAILURE;
+	}
+	if(getenv("CGBP_BENCH") != NULL)
+		return lorenz_bench(mib) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+	if((env = getenv("LORENZ_PARTICLES")) != NULL)
+		particles = strtoul(env, NULL, 10);
+	if(cgbp_init(&c) < 0 || lorenz_init(&l, particles > 0 ? 0 : mib, 0) < 0 ||
+	  (particles > 0 && lorenz_cloud_init(&l, particles) < 0))
 		goto error;
 	cam_updatepos(&l.c);
+	lorenz_ramp(l.ramp);
 	size = driver.size(&c);
 	l.c.fac = MIN(size.w, size.h);
 	if(cgbp_main(&c, &l,
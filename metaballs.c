@@ -10,55 +10,124 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "cgbp.h"
 #include "hsv.h"
+#include "kernel.h"
+#include "pool.h"
 
+// the default ball count; more balls get smaller radii
 #define NUM_BALLS 6
 #define NUM_RGB_CACHE 1024
+// balls are binned into square tiles; a row of tiles is one pool task
+#define METABALLS_TILE 64
+// colour steps below which a ball's contribution is cut off by default
+#define METABALLS_CUTOFF 1
+// grid spacing of METABALLS_ADAPTIVE, a power of two dividing the tile
+#define METABALLS_BLOCK 8
+// where the colours saturate, in units of the field
+#define METABALLS_SATURATE (256.f)
+#ifndef METABALLS_DEFAULT_FIELD
+#define METABALLS_DEFAULT_FIELD "rsqrt"
+#endif
 #define ABS(x) ((x) < 0 ? -(x) : (x))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define TO_RGB(r, g, b) \
 	(((uint32_t)(r) << 16) | ((uint32_t)(g) << 8) | (uint32_t)(b))
 
+/* beyond reach pixels, a ball adds less than cutoff colour steps and is
+ * left out; reach2 is its square, saturated. old_x and old_y are where it
+ * was last frame. */
 struct ball {
-	size_t x, y;
+	size_t x, y, old_x, old_y, reach;
 	long speed_x, speed_y;
-	float *dist_cache;
+	float radius;
+	int32_t reach2;
 };
 
+/* a ball contributes 255 * radius / distance. with dist_cache set, the
+ * 1 / distance part is looked up in a table covering one quadrant of the
+ * screen, shared by all balls; otherwise it's computed as it's needed.
+ * METABALLS_FIELD=table|rsqrt picks one.
+ *
+ * each frame, balls are binned into the tiles their reach overlaps:
+ * tile t's balls are tile_balls[tile_start[t]] up to tile_start[t + 1].
+ * rows of tiles are drawn by the pool, each worker with its own acc and
+ * line. num_balls and cutoff are set before metaballs_init; 0 means
+ * NUM_BALLS, and a cutoff of 0 keeps every ball everywhere.
+ *
+ * with adaptive above 0, tiles are drawn from the field on a grid of
+ * METABALLS_BLOCK instead, see metaballs_block; evals counts the field
+ * evaluations of the last frame per worker.
+ *
+ * with refresh above 0, field keeps the sum over the whole screen from
+ * frame to frame. balls that moved are taken out where they were and
+ * added where they are, within their reach, and only the tiles that
+ * touches are coloured again and flagged in damage. every refresh frames,
+ * it's summed from scratch, which bounds the rounding errors. */
 struct metaballs {
-	struct ball balls[NUM_BALLS];
+	struct cgbp_pool pool;
+	struct ball *balls;
+	size_t num_balls;
+	double cutoff, adaptive;
+	struct metaballs_tile *tiles;
+	uint32_t *centres;
+	size_t evals[CGBP_POOL_MAX], refresh, frame, damaged;
+	float *field;
+	uint8_t *damage;
 	uint32_t rgb_cache[NUM_RGB_CACHE];
+	float *dist_cache, *acc;
+	uint32_t *lines, *tile_balls;
+	size_t tiles_w, tiles_h, *tile_start, *tile_fill, tile_balls_len;
+	struct cgbp_size size;
+	const struct cgbp_fb *out;
+};
+
+#define METABALLS_CORNERS ((METABALLS_TILE + 1) * (METABALLS_TILE + 1))
+
+/* a worker's state for one tile of METABALLS_ADAPTIVE. field holds the
+ * colour index at each pixel corner of the tile: -1 where it's unknown,
+ * -2 where it's queued in px and py, to be evaluated in one batch with
+ * all other points of the same level. blocks has the blocks of the
+ * current level and the next, centres the balls centred on the tile. */
+struct metaballs_tile {
+	struct metaballs *m;
+	const struct cgbp_fb *fb;
+	int direct;
+	const uint32_t *balls;
+	uint32_t *line, *centres;
+	size_t n, x, y, num_points, num_blocks[2], num_centres, evals;
+	float field[METABALLS_CORNERS], values[METABALLS_CORNERS];
+	int32_t px[METABALLS_CORNERS], py[METABALLS_CORNERS];
+	uint16_t points[METABALLS_CORNERS];
+	uint8_t blocks[2][METABALLS_TILE * METABALLS_TILE / 4][2];
 };
 
 static inline float rsqrt(float n) {
-	void *v;
-	int i;
+	int32_t i;
 	float x2;
 	x2 = n * 0.5F;
-	v  = &n;
-	i  = *(int*)v;                      // evil floating point bit level hacking
+	memcpy(&i, &n, sizeof i);           // evil floating point bit level hacking
 	i  = 0x5f3759df - (i >> 1);         // what the fuck?
-	v  = &i;
-	n  = *(float*)v;
+	memcpy(&n, &i, sizeof n);
 	n  = n * (1.5F - (x2 * n * n));     // 1st iteration
 	return n;
 }
 
-static inline int metaballs_init_dist_cache(struct ball *b, float radius,
+static inline int metaballs_init_dist_cache(struct metaballs *m,
                                             struct cgbp_size size) {
 	size_t x, y;
-	float *dist;
-	b->dist_cache = malloc(size.w * size.h * sizeof *b->dist_cache);
-	if(b->dist_cache == NULL) {
+	m->dist_cache = malloc(size.w * size.h * sizeof *m->dist_cache);
+	if(m->dist_cache == NULL) {
 		perror("malloc");
 		return -1;
 	}
 	for(y = 0; y < size.h; y++)
-		for(x = 0; x < size.w; x++) {
-			dist = &b->dist_cache[y * size.w + x];
-			*dist = 255 * radius * rsqrt(x * x + y * y);
-		}
+		for(x = 0; x < size.w; x++)
+			m->dist_cache[y * size.w + x] = rsqrt(x * x + y * y);
 	return 0;
 }
 
@@ -75,48 +144,534 @@ static inline void metaballs_init_color(struct metaballs *m) {
 			hue = (float)i / NUM_RGB_CACHE + rnd;
 		hue *= mult;
 		hsv_to_rgb(rgb, hue - floor(hue), 1.0, .8);
-		m->rgb_cache[i] = TO_RGB(rgb[0] * 255, rgb[1] * 255, rgb[2] * 255);
+		// opaque, so rows can go straight to ARGB8888 as well
+		m->rgb_cache[i] = 0xff000000 |
+			TO_RGB(rgb[0] * 255, rgb[1] * 255, rgb[2] * 255);
+	}
+}
+
+// where a ball's contribution drops below the cutoff
+static inline void metaballs_reach(struct metaballs *m, struct ball *b,
+                                   struct cgbp_size size) {
+	double reach = m->cutoff > 0 ?
+		255. * (NUM_RGB_CACHE / 256) * b->radius / m->cutoff : 0;
+	if(m->cutoff <= 0 || reach >= size.w + size.h) {
+		b->reach = size.w + size.h;
+		b->reach2 = INT32_MAX;
+		return;
 	}
+	b->reach = reach + 1;
+	b->reach2 = MIN(reach * reach, INT32_MAX);
 }
 
-int metaballs_init(struct metaballs *m, struct cgbp_size size) {
+// threads 0 sizes the pool from CGBP_THREADS
+int metaballs_init(struct metaballs *m, struct cgbp_size size,
+                   const char *field, size_t threads) {
 	size_t i;
-	m->balls[0].x = 600;
-	m->balls[0].y = 600;
-	for(i = 0; i < NUM_BALLS; i++)
-		m->balls[i].dist_cache = NULL;
-	for(i = 0; i < NUM_BALLS; i++) {
+	m->dist_cache = NULL;
+	m->acc = NULL;
+	m->lines = NULL;
+	m->tiles = NULL;
+	m->centres = NULL;
+	m->field = NULL;
+	m->damage = NULL;
+	m->balls = NULL;
+	m->tile_balls = NULL;
+	m->tile_start = m->tile_fill = NULL;
+	m->tile_balls_len = 0;
+	m->frame = 0;
+	if(m->num_balls == 0)
+		m->num_balls = NUM_BALLS;
+	m->tiles_w = (size.w + METABALLS_TILE - 1) / METABALLS_TILE;
+	m->tiles_h = (size.h + METABALLS_TILE - 1) / METABALLS_TILE;
+	if(m->adaptive > 0 && m->refresh > 0) {
+		fprintf(stderr, "Error: METABALLS_ADAPTIVE and METABALLS_INCREMENTAL "
+		        "don't combine.\n");
+		return -1;
+	}
+	if(cgbp_pool_init(&m->pool, threads) < 0)
+		return -1;
+	m->acc = malloc(size.w * m->pool.size * sizeof *m->acc);
+	m->lines = malloc(size.w * m->pool.size * sizeof *m->lines);
+	m->balls = malloc(m->num_balls * sizeof *m->balls);
+	m->tile_start = malloc((m->tiles_w * m->tiles_h + 1) *
+	                       sizeof *m->tile_start);
+	m->tile_fill = malloc(m->tiles_w * m->tiles_h * sizeof *m->tile_fill);
+	if(m->adaptive > 0) {
+		m->tiles = malloc(m->pool.size * sizeof *m->tiles);
+		m->centres = malloc(m->pool.size * m->num_balls * sizeof *m->centres);
+	}
+	if(m->refresh > 0) {
+		m->field = malloc(size.w * size.h * sizeof *m->field);
+		m->damage = malloc(m->tiles_w * m->tiles_h);
+	}
+	if(m->acc == NULL || m->lines == NULL || m->balls == NULL ||
+	  m->tile_start == NULL || m->tile_fill == NULL ||
+	  (m->adaptive > 0 && (m->tiles == NULL || m->centres == NULL)) ||
+	  (m->refresh > 0 && (m->field == NULL || m->damage == NULL))) {
+		perror("malloc");
+		return -1;
+	}
+	if(strcmp(field, "table") == 0) {
+		if(metaballs_init_dist_cache(m, size) < 0)
+			return -1;
+	} else if(strcmp(field, "rsqrt") != 0) {
+		fprintf(stderr, "Error: METABALLS_FIELD: expected table or rsqrt.\n");
+		return -1;
+	}
+	for(i = 0; i < m->num_balls; i++) {
 		m->balls[i].x = rand() % size.w;
 		m->balls[i].y = rand() % size.h;
 		m->balls[i].speed_x = rand() % 20;
 		m->balls[i].speed_y = rand() % 20;
-		if(metaballs_init_dist_cache(&m->balls[i], 30 + rand() % 60, size) < 0)
-			return -1;
+		// keep the total field about the same
+		m->balls[i].radius = (float)(30 + rand() % 60) * NUM_BALLS /
+		                     MAX(m->num_balls, NUM_BALLS);
+		metaballs_reach(m, &m->balls[i], size);
 	}
 	metaballs_init_color(m);
 	return 0;
 }
 
-static inline float ball_dist(struct ball *b, size_t x, size_t y,
-                              struct cgbp_size size) {
-	if(b->x > x)
-		x = b->x - x;
-	else
-		x -= b->x;
-	if(b->y > y)
-		y = b->y - y;
+// clamped with selects, so the whole loop turns into min, max and gather
+CGBP_KERNEL(metaballs_colour, (const uint32_t *rgb_cache,
+                               const float *restrict acc,
+                               uint32_t *restrict out, size_t n),
+            (rgb_cache, acc, out, n)) {
+	int32_t x, w = n;
+	float dist;
+	for(x = 0; x < w; x++) {
+		dist = acc[x] * (NUM_RGB_CACHE / 256);
+		dist = dist < 0 ? 0 : dist;
+		dist = dist < NUM_RGB_CACHE - 1 ? dist : NUM_RGB_CACHE - 1;
+		out[x] = rgb_cache[(int32_t)dist];
+	}
+}
+
+/* sum the field of balls over pixels [x0, x1) of row y into acc, then
+ * colour them. per ball, the distances to its left and right are
+ * contiguous runs of a dist_cache row, or a vector of rsqrts, so there's
+ * nothing to gather but the colours. */
+CGBP_KERNEL(metaballs_span, (const struct metaballs *m,
+                             const uint32_t *balls, size_t n, size_t y,
+                             size_t x0, size_t x1, float *restrict acc,
+                             uint32_t *restrict out),
+            (m, balls, n, y, x0, x1, acc, out)) {
+	const struct ball *b;
+	const float *row;
+	size_t i;
+	int32_t x, w = x1 - x0, left, far, dx, dy, dy2, d2, reach2;
+	float scale;
+	for(x = 0; x < w; x++)
+		acc[x] = 0;
+	for(i = 0; i < n; i++) {
+		b = &m->balls[balls[i]];
+		scale = 255 * b->radius;
+		dx = (int32_t)x0 - (int32_t)b->x;
+		dy = b->y > y ? b->y - y : y - b->y;
+		dy2 = dy * dy;
+		reach2 = b->reach2;
+		if(dy2 >= reach2)
+			continue;
+		if(m->dist_cache != NULL) {
+			row = m->dist_cache + m->size.w * dy;
+			left = MIN(MAX(-dx, 0), w);
+			far = MAX(-dx, dx + w - 1);
+			// the whole span in reach is just loads and adds
+			if((int64_t)far * far + dy2 < reach2) {
+				for(x = 0; x < left; x++)
+					acc[x] += scale * row[-dx - x];
+				for(x = left; x < w; x++)
+					acc[x] += scale * row[dx + x];
+				continue;
+			}
+			// out of reach multiplies by 0 rather than branching, to vectorize
+			for(x = 0; x < left; x++) {
+				d2 = (dx + x) * (dx + x) + dy2;
+				acc[x] += scale * row[-dx - x] * (d2 < reach2);
+			}
+			for(x = left; x < w; x++) {
+				d2 = (dx + x) * (dx + x) + dy2;
+				acc[x] += scale * row[dx + x] * (d2 < reach2);
+			}
+			continue;
+		}
+		// squared in integers, then converted, like the table does
+		for(x = 0; x < w; x++) {
+			d2 = (dx + x) * (dx + x) + dy2;
+			acc[x] += scale * rsqrt(d2) * (d2 < reach2);
+		}
+	}
+	metaballs_colour_impl(m->rgb_cache, acc, out, w);
+}
+
+/* add sign times a ball's field to the n pixels of acc, which are dx from
+ * it along a row dy2 away squared. near its centre, it's capped where the
+ * colours saturate anyway, so taking it out again leaves no huge value to
+ * cancel. */
+CGBP_KERNEL(metaballs_stamp_row, (float *restrict acc, int32_t dx,
+                                  int32_t dy2, int32_t reach2, float scale,
+                                  float sign, size_t n),
+            (acc, dx, dy2, reach2, scale, sign, n)) {
+	int32_t x, w = n, d2;
+	float v;
+	for(x = 0; x < w; x++) {
+		d2 = (dx + x) * (dx + x) + dy2;
+		v = scale * rsqrt(d2);
+		v = v < METABALLS_SATURATE ? v : METABALLS_SATURATE;
+		acc[x] += sign * v * (d2 < reach2);
+	}
+}
+
+// add sign times ball b at x, y to row r of the field
+static inline void metaballs_stamp(struct metaballs *m, const struct ball *b,
+                                   size_t x, size_t y, float sign, size_t r,
+                                   uint8_t *damage) {
+	size_t x0 = x > b->reach ? x - b->reach : 0,
+	       x1 = MIN(x + b->reach + 1, m->size.w);
+	int32_t dy = (int32_t)r - (int32_t)y;
+	if(dy * dy >= b->reach2 || (size_t)ABS(dy) > b->reach)
+		return;
+	metaballs_stamp_row(m->field + r * m->size.w + x0,
+	                    (int32_t)x0 - (int32_t)x, dy * dy, b->reach2,
+	                    255 * b->radius, sign, x1 - x0);
+	memset(damage + x0 / METABALLS_TILE, 1,
+	       (x1 - 1) / METABALLS_TILE - x0 / METABALLS_TILE + 1);
+}
+
+/* update a row of tiles of the field for the balls that moved, or sum it
+ * from scratch, then colour the tiles that changed. rows go in the outer
+ * loop so each stays in cache while the balls are stamped onto it. */
+static inline void metaballs_band_incremental(struct metaballs *m,
+                                              const struct cgbp_fb *fb,
+                                              int direct, size_t ty,
+                                              uint32_t *line) {
+	const struct ball *b;
+	uint8_t *damage = m->damage + ty * m->tiles_w;
+	uint32_t *out;
+	size_t i, x, y, tx, tx1, x0, x1, y0 = ty * METABALLS_TILE,
+	       y1 = MIN(y0 + METABALLS_TILE, m->size.h);
+	int full = m->frame % m->refresh == 0;
+	memset(damage, full, m->tiles_w);
+	for(y = y0; y < y1; y++) {
+		if(full)
+			memset(m->field + y * m->size.w, 0, m->size.w * sizeof *m->field);
+		for(i = 0; i < m->num_balls; i++) {
+			b = &m->balls[i];
+			if(full) {
+				metaballs_stamp(m, b, b->x, b->y, 1, y, damage);
+				continue;
+			}
+			if(b->x == b->old_x && b->y == b->old_y)
+				continue;
+			metaballs_stamp(m, b, b->old_x, b->old_y, -1, y, damage);
+			metaballs_stamp(m, b, b->x, b->y, 1, y, damage);
+		}
+	}
+	for(tx = 0; tx < m->tiles_w; tx = tx1) {
+		for(tx1 = tx + 1; tx1 < m->tiles_w && damage[tx1] == damage[tx]; tx1++);
+		if(!damage[tx])
+			continue;
+		x0 = tx * METABALLS_TILE;
+		x1 = MIN(tx1 * METABALLS_TILE, m->size.w);
+		for(y = y0; y < y1; y++) {
+			out = direct ? (uint32_t*)cgbp_fb_row(fb, y) : line;
+			metaballs_colour(m->rgb_cache, m->field + y * m->size.w + x0,
+			                 out + x0, x1 - x0);
+			if(!direct)
+				for(x = x0; x < x1; x++)
+					cgbp_fb_set_pixel(fb, x, y, line[x]);
+		}
+	}
+}
+
+// fill out with the colours of n indices running from v by step
+CGBP_KERNEL(metaballs_lerp, (const uint32_t *rgb_cache, uint32_t *out,
+                             float v, float step, size_t n),
+            (rgb_cache, out, v, step, n)) {
+	size_t i;
+	for(i = 0; i < n; i++)
+		out[i] = rgb_cache[(int32_t)(v + step * i)];
+}
+
+/* the colour index at k points, summed like the spans do. balls go in
+ * the outer loop, so this vectorizes over the points */
+CGBP_KERNEL(metaballs_points, (const struct metaballs *m,
+                               const uint32_t *balls, size_t n,
+                               const int32_t *px, const int32_t *py,
+                               size_t k, float *restrict out),
+            (m, balls, n, px, py, k, out)) {
+	const struct ball *b;
+	size_t i, j;
+	int32_t bx, by, dx, dy, d2, reach2;
+	float dist, scale;
+	for(j = 0; j < k; j++)
+		out[j] = 0;
+	for(i = 0; i < n; i++) {
+		b = &m->balls[balls[i]];
+		scale = 255 * b->radius;
+		bx = b->x;
+		by = b->y;
+		reach2 = b->reach2;
+		for(j = 0; j < k; j++) {
+			dx = px[j] - bx;
+			dy = py[j] - by;
+			d2 = dx * dx + dy * dy;
+			out[j] += scale * rsqrt(d2) * (d2 < reach2);
+		}
+	}
+	for(j = 0; j < k; j++) {
+		dist = out[j] * (NUM_RGB_CACHE / 256);
+		dist = dist < 0 ? 0 : dist;
+		out[j] = dist < NUM_RGB_CACHE - 1 ? dist : NUM_RGB_CACHE - 1;
+	}
+}
+
+// queue the corner at x, y within the tile, unless it's known
+static inline void metaballs_want(struct metaballs_tile *t, size_t x,
+                                  size_t y) {
+	size_t i = y * (METABALLS_TILE + 1) + x;
+	if(t->field[i] != -1)
+		return;
+	t->field[i] = -2;
+	t->px[t->num_points] = t->x + x;
+	t->py[t->num_points] = t->y + y;
+	t->points[t->num_points++] = i;
+}
+
+static inline void metaballs_eval(struct metaballs_tile *t) {
+	size_t i;
+	metaballs_points(t->m, t->balls, t->n, t->px, t->py, t->num_points,
+	                 t->values);
+	for(i = 0; i < t->num_points; i++)
+		t->field[t->points[i]] = t->values[i];
+	t->evals += t->num_points;
+	t->num_points = 0;
+}
+
+// queue the block at x, y for the next level, with its corners
+static inline void metaballs_queue(struct metaballs_tile *t, size_t next,
+                                   size_t x, size_t y, size_t s) {
+	uint8_t *b = t->blocks[next][t->num_blocks[next]++];
+	b[0] = x;
+	b[1] = y;
+	metaballs_want(t, x, y);
+	metaballs_want(t, x + s, y);
+	metaballs_want(t, x, y + s);
+	metaballs_want(t, x + s, y + s);
+}
+
+static inline void metaballs_put(const struct metaballs_tile *t, size_t x,
+                                 size_t y, uint32_t color) {
+	if(t->direct)
+		((uint32_t*)cgbp_fb_row(t->fb, t->y + y))[t->x + x] = color;
 	else
-		y -= b->y;
-	return b->dist_cache[y * size.w + x];
+		cgbp_fb_set_pixel(t->fb, t->x + x, t->y + y, color);
 }
 
-int metaballs_update(struct cgbp *c, void *data) {
+// whether a ball's centre, where the field peaks, is in or on the block
+static inline int metaballs_has_centre(const struct metaballs_tile *t,
+                                       size_t x, size_t y, size_t s) {
+	const struct ball *b;
+	size_t i;
+	x += t->x;
+	y += t->y;
+	for(i = 0; i < t->num_centres; i++) {
+		b = &t->m->balls[t->centres[i]];
+		if(b->x >= x && b->x <= x + s && b->y >= y && b->y <= y + s)
+			return 1;
+	}
+	return 0;
+}
+
+/* draw the s by s block at x, y within the tile by interpolating its
+ * corners bilinearly, or split it in four for the next level if they're
+ * more than adaptive apart or a ball's centre is near. a 2 by 2 block is
+ * queued whole, as a block of 1 whose corners are the four pixels, which
+ * then get their exact colour. */
+static inline void metaballs_block(struct metaballs_tile *t, size_t next,
+                                   size_t x, size_t y, size_t s) {
+	const struct metaballs *m = t->m;
+	const float *f = &t->field[y * (METABALLS_TILE + 1) + x];
+	float c00 = f[0], c10 = f[s], c01 = f[s * (METABALLS_TILE + 1)],
+	      c11 = f[s * (METABALLS_TILE + 2)], l, r;
+	size_t i, j, w = MIN(MAX(s, 2), m->size.w - t->x - x),
+	       h = MIN(MAX(s, 2), m->size.h - t->y - y);
+	uint32_t *out;
+	if(s == 1) {
+		for(j = 0; j < h; j++)
+			for(i = 0; i < w; i++)
+				metaballs_put(t, x + i, y + j, m->rgb_cache[(int32_t)
+				              f[j * (METABALLS_TILE + 1) + i]]);
+		return;
+	}
+	if(MAX(MAX(c00, c10), MAX(c01, c11)) -
+	  MIN(MIN(c00, c10), MIN(c01, c11)) > m->adaptive ||
+	  metaballs_has_centre(t, x, y, s)) {
+		if(s == 2)
+			metaballs_queue(t, next, x, y, 1);
+		else
+			for(j = 0; j < h; j += s / 2)
+				for(i = 0; i < w; i += s / 2)
+					metaballs_queue(t, next, x + i, y + j, s / 2);
+		return;
+	}
+	for(j = 0; j < h; j++) {
+		l = c00 + (c01 - c00) * j / s;
+		r = c10 + (c11 - c10) * j / s;
+		out = t->direct ? (uint32_t*)cgbp_fb_row(t->fb, t->y + y + j) +
+		                  t->x + x : t->line;
+		metaballs_lerp(m->rgb_cache, out, l, (r - l) / s, w);
+		if(!t->direct)
+			for(i = 0; i < w; i++)
+				cgbp_fb_set_pixel(t->fb, t->x + x + i, t->y + y + j, out[i]);
+	}
+}
+
+/* draw tile number tile from a grid of METABALLS_BLOCK, refining level by
+ * level where it's needed */
+static inline void metaballs_adaptive_tile(struct metaballs_tile *t,
+                                           size_t tile) {
+	struct metaballs *m = t->m;
+	const struct ball *b;
+	size_t i, x, y, s, cur = 0;
+	t->balls = m->tile_balls + m->tile_start[tile];
+	t->n = m->tile_start[tile + 1] - m->tile_start[tile];
+	t->x = tile % m->tiles_w * METABALLS_TILE;
+	t->y = tile / m->tiles_w * METABALLS_TILE;
+	for(i = t->num_centres = 0; i < t->n; i++) {
+		b = &m->balls[t->balls[i]];
+		if(b->x >= t->x && b->x <= t->x + METABALLS_TILE &&
+		  b->y >= t->y && b->y <= t->y + METABALLS_TILE)
+			t->centres[t->num_centres++] = t->balls[i];
+	}
+	for(i = 0; i < METABALLS_CORNERS; i++)
+		t->field[i] = -1;
+	t->num_points = t->num_blocks[cur] = 0;
+	for(y = 0; y < METABALLS_TILE && t->y + y < m->size.h;
+	  y += METABALLS_BLOCK)
+		for(x = 0; x < METABALLS_TILE && t->x + x < m->size.w;
+		  x += METABALLS_BLOCK)
+			metaballs_queue(t, cur, x, y, METABALLS_BLOCK);
+	for(s = METABALLS_BLOCK; t->num_blocks[cur] > 0; s /= 2) {
+		metaballs_eval(t);
+		t->num_blocks[!cur] = 0;
+		for(i = 0; i < t->num_blocks[cur]; i++)
+			metaballs_block(t, !cur, t->blocks[cur][i][0],
+			                t->blocks[cur][i][1], s);
+		cur = !cur;
+	}
+}
+
+// tiles t and u list the same balls
+static inline int metaballs_same_tile(const struct metaballs *m, size_t t,
+                                      size_t u) {
+	size_t n = m->tile_start[t + 1] - m->tile_start[t];
+	return m->tile_start[u + 1] - m->tile_start[u] == n &&
+	       memcmp(m->tile_balls + m->tile_start[t],
+	              m->tile_balls + m->tile_start[u],
+	              n * sizeof *m->tile_balls) == 0;
+}
+
+/* draw a row of tiles, straight into the framebuffer where it's 32 bit.
+ * neighbouring tiles with the same balls are drawn as one span, which
+ * keeps the vector loops long when every ball reaches everywhere. */
+static void metaballs_band(void *data, size_t ty, size_t worker) {
 	struct metaballs *m = data;
-	struct cgbp_size size = driver.size(c);
-	size_t i, x, y;
+	struct cgbp_fb fb = *m->out;
+	float *acc = m->acc + worker * m->size.w;
+	uint32_t *line = m->lines + worker * m->size.w, *out;
+	size_t x, y, tx, tx1, t, x0, x1,
+	       y1 = MIN((ty + 1) * METABALLS_TILE, m->size.h);
+	int direct = CGBP_FB_FORMAT(&fb) == CGBP_FORMAT_XRGB8888 ||
+	             CGBP_FB_FORMAT(&fb) == CGBP_FORMAT_ARGB8888;
+	struct metaballs_tile *tile;
+	if(m->refresh > 0) {
+		metaballs_band_incremental(m, &fb, direct, ty, line);
+		return;
+	}
+	if(m->adaptive > 0) {
+		tile = &m->tiles[worker];
+		tile->m = m;
+		tile->fb = &fb;
+		tile->direct = direct;
+		tile->line = line;
+		tile->centres = m->centres + worker * m->num_balls;
+		tile->evals = 0;
+		for(tx = 0; tx < m->tiles_w; tx++)
+			metaballs_adaptive_tile(tile, ty * m->tiles_w + tx);
+		m->evals[worker] += tile->evals;
+		return;
+	}
+	for(tx = 0; tx < m->tiles_w; tx = tx1) {
+		t = ty * m->tiles_w + tx;
+		for(tx1 = tx + 1; tx1 < m->tiles_w &&
+		  metaballs_same_tile(m, t, ty * m->tiles_w + tx1); tx1++);
+		x0 = tx * METABALLS_TILE;
+		x1 = MIN(tx1 * METABALLS_TILE, m->size.w);
+		for(y = ty * METABALLS_TILE; y < y1; y++) {
+			out = direct ? (uint32_t*)cgbp_fb_row(&fb, y) : line;
+			metaballs_span(m, m->tile_balls + m->tile_start[t],
+			               m->tile_start[t + 1] - m->tile_start[t], y, x0, x1,
+			               acc, out + x0);
+			if(!direct)
+				for(x = x0; x < x1; x++)
+					cgbp_fb_set_pixel(&fb, x, y, line[x]);
+		}
+	}
+}
+
+/* bin the balls by the tiles their reach overlaps, counting first and then
+ * filling, so each tile lists its balls in order */
+static inline int metaballs_bin(struct metaballs *m) {
+	const struct ball *b;
+	size_t i, tx, ty, t, n = m->tiles_w * m->tiles_h, pass, x0, x1, y0, y1;
+	uint32_t *tile_balls;
+	for(pass = 0; pass < 2; pass++) {
+		if(pass == 0)
+			memset(m->tile_start, 0, (n + 1) * sizeof *m->tile_start);
+		else
+			memcpy(m->tile_fill, m->tile_start, n * sizeof *m->tile_fill);
+		for(i = 0; i < m->num_balls; i++) {
+			b = &m->balls[i];
+			x0 = (b->x > b->reach ? b->x - b->reach : 0) / METABALLS_TILE;
+			y0 = (b->y > b->reach ? b->y - b->reach : 0) / METABALLS_TILE;
+			x1 = MIN((b->x + b->reach) / METABALLS_TILE, m->tiles_w - 1);
+			y1 = MIN((b->y + b->reach) / METABALLS_TILE, m->tiles_h - 1);
+			for(ty = y0; ty <= y1; ty++)
+				for(tx = x0; tx <= x1; tx++) {
+					t = ty * m->tiles_w + tx;
+					if(pass == 0)
+						m->tile_start[t + 1]++;
+					else
+						m->tile_balls[m->tile_fill[t]++] = i;
+				}
+		}
+		if(pass > 0)
+			break;
+		for(t = 0; t < n; t++)
+			m->tile_start[t + 1] += m->tile_start[t];
+		if(m->tile_start[n] <= m->tile_balls_len)
+			continue;
+		tile_balls = realloc(m->tile_balls,
+		                     m->tile_start[n] * sizeof *m->tile_balls);
+		if(tile_balls == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		m->tile_balls = tile_balls;
+		m->tile_balls_len = m->tile_start[n];
+	}
+	return 0;
+}
+
+static inline int metaballs_frame(struct metaballs *m, struct cgbp_size size,
+                                  const struct cgbp_fb *fb) {
+	size_t i, t;
 	long remainder;
-	float dist;
-	for(i = 0; i < NUM_BALLS; i++) {
+	for(i = 0; i < m->num_balls; i++) {
+		m->balls[i].old_x = m->balls[i].x;
+		m->balls[i].old_y = m->balls[i].y;
 		// check if the difference would wrap beyond the screen
 		if(m->balls[i].speed_x > 0)
 			remainder = size.w - 1 - m->balls[i].x;
@@ -140,35 +695,351 @@ int metaballs_update(struct cgbp *c, void *data) {
 			m->balls[i].y += m->balls[i].speed_y + remainder;
 		}
 	}
-	for(y = 0; y < size.h; y++)
-		for(x = 0; x < size.w; x++) {
-			dist = 0;
-			for(i = 0; i < NUM_BALLS; i++)
-				dist += ball_dist(&m->balls[i], x, y, size);
-			dist *= NUM_RGB_CACHE / 256;
-			if(dist < 0)
-				dist = 0;
-			else if(dist >= NUM_RGB_CACHE)
-				dist = NUM_RGB_CACHE - 1;
-			driver.set_pixel(c, x, y, m->rgb_cache[(size_t)dist]);
-		}
+	m->size = size;
+	m->out = fb;
+	memset(m->evals, 0, sizeof m->evals);
+	if(m->refresh == 0 && metaballs_bin(m) < 0)
+		return -1;
+	cgbp_pool_run(&m->pool, m->tiles_h, metaballs_band, m);
+	if(m->refresh > 0) {
+		m->frame++;
+		for(m->damaged = t = 0; t < m->tiles_w * m->tiles_h; t++)
+			m->damaged += m->damage[t];
+	}
 	return 0;
 }
 
+int metaballs_update(struct cgbp *c, void *data) {
+	struct cgbp_fb fb = c->fb;
+	return metaballs_frame(data, driver.size(c), &fb);
+}
+
 int metaballs_action(struct cgbp *c, void *data, char r) {
 	if(r == 'q' || r == 'Q')
 		c->running = 0;
-	if(r == ' ')
+	if(r == ' ') {
 		metaballs_init_color(data);
+		// summing from scratch colours every tile anew
+		((struct metaballs*)data)->frame = 0;
+	}
 	return 0;
 }
 
 void metaballs_cleanup(struct metaballs *m) {
-	size_t i;
-	for(i = 0; i < NUM_BALLS; i++)
-		if(m->balls[i].dist_cache != NULL)
-			free(m->balls[i].dist_cache);
-	return;
+	cgbp_pool_cleanup(&m->pool);
+	free(m->dist_cache);
+	free(m->acc);
+	free(m->lines);
+	free(m->tiles);
+	free(m->centres);
+	free(m->field);
+	free(m->damage);
+	free(m->balls);
+	free(m->tile_balls);
+	free(m->tile_start);
+	free(m->tile_fill);
+	m->dist_cache = NULL;
+	m->acc = NULL;
+	m->lines = NULL;
+	m->tiles = NULL;
+	m->centres = NULL;
+	m->field = NULL;
+	m->damage = NULL;
+	m->balls = NULL;
+	m->tile_balls = NULL;
+	m->tile_start = m->tile_fill = NULL;
+}
+
+#define METABALLS_BENCH_FRAMES 16
+#define METABALLS_BENCH_BALL_FRAMES 4
+#define METABALLS_BENCH_REFRESH 64
+
+static inline int metaballs_bench_fb(struct cgbp_fb *fb,
+                                     struct cgbp_size size) {
+	*fb = (struct cgbp_fb){
+		NULL, NULL, size.w, size.h, size.w * 4, CGBP_FORMAT_XRGB8888,
+	};
+	fb->data = malloc(fb->stride * fb->h);
+	if(fb->data == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	return 0;
+}
+
+// how many pixels differ between two images, and the most in any channel
+static inline void metaballs_bench_diff(const struct cgbp_fb *ref,
+                                        const struct cgbp_fb *fb,
+                                        size_t *differ, size_t *worst) {
+	size_t i, k, n = ref->w * ref->h;
+	uint32_t a, b;
+	for(*differ = *worst = i = 0; i < n; i++) {
+		a = ((uint32_t*)ref->data)[i];
+		b = ((uint32_t*)fb->data)[i];
+		if((a & 0xffffff) == (b & 0xffffff))
+			continue;
+		(*differ)++;
+		for(k = 0; k < 24; k += 8)
+			*worst = MAX(*worst, (size_t)ABS((int)(a >> k & 0xff) -
+			                                 (int)(b >> k & 0xff)));
+	}
+}
+
+// frame time and pixels per second over thread counts, in total and per
+// thread
+static inline int metaballs_bench_threads(const char *field) {
+	static const struct cgbp_size size = { 1920, 1080 };
+	struct metaballs m;
+	struct cgbp_fb fb;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t k, threads, max = cpus > 0 ? (size_t)cpus : 1;
+	double start, elapsed, rate;
+	if(metaballs_bench_fb(&fb, size) < 0)
+		return -1;
+	fprintf(stderr, "%zux%zu %s\n%7s %9s %9s %10s\n", size.w, size.h, field,
+	        "threads", "ms/frame", "Mpixel/s", "per thread");
+	for(threads = 1; threads <= max; threads =
+	  threads < max && threads * 2 > max ? max : threads * 2) {
+		srand(1);
+		m = (struct metaballs){ .cutoff = METABALLS_CUTOFF, };
+		if(metaballs_init(&m, size, field, threads) < 0) {
+			metaballs_cleanup(&m);
+			free(fb.data);
+			return -1;
+		}
+		start = cgbp_time();
+		for(k = 0; k < METABALLS_BENCH_FRAMES; k++)
+			metaballs_frame(&m, size, &fb);
+		elapsed = (cgbp_time() - start) / METABALLS_BENCH_FRAMES;
+		rate = size.w * size.h / elapsed / 1e6;
+		fprintf(stderr, "%7zu %9.2f %9.1f %10.1f\n", threads, elapsed * 1e3,
+		        rate, rate / threads);
+		metaballs_cleanup(&m);
+	}
+	free(fb.data);
+	return 0;
+}
+
+// frame time as the ball count grows, with and without the cutoff
+static inline int metaballs_bench_balls(void) {
+	static const struct cgbp_size size = { 1920, 1080 };
+	static const size_t counts[] = { 6, 24, 96, 384, 1536 };
+	static const double cutoffs[] = { 0, METABALLS_CUTOFF };
+	struct metaballs m;
+	struct cgbp_fb fb;
+	size_t i, j, k;
+	double start;
+	if(metaballs_bench_fb(&fb, size) < 0)
+		return -1;
+	fprintf(stderr, "%zux%zu rsqrt\n%6s %6s %9s %10s\n", size.w, size.h,
+	        "balls", "cutoff", "ms/frame", "balls/tile");
+	for(i = 0; i < sizeof counts / sizeof *counts; i++)
+		for(j = 0; j < sizeof cutoffs / sizeof *cutoffs; j++) {
+			srand(1);
+			m = (struct metaballs){
+				.num_balls = counts[i], .cutoff = cutoffs[j],
+			};
+			if(metaballs_init(&m, size, "rsqrt", 0) < 0)
+				goto error;
+			start = cgbp_time();
+			for(k = 0; k < METABALLS_BENCH_BALL_FRAMES; k++)
+				if(metaballs_frame(&m, size, &fb) < 0)
+					goto error;
+			fprintf(stderr, "%6zu %6g %9.2f %10.1f\n", counts[i], cutoffs[j],
+			        (cgbp_time() - start) * 1e3 / METABALLS_BENCH_BALL_FRAMES,
+			        (double)m.tile_start[m.tiles_w * m.tiles_h] /
+			        (m.tiles_w * m.tiles_h));
+			metaballs_cleanup(&m);
+		}
+	free(fb.data);
+	return 0;
+error:
+	metaballs_cleanup(&m);
+	free(fb.data);
+	return -1;
+}
+
+// differences and frame time of METABALLS_ADAPTIVE against per pixel
+static inline int metaballs_bench_adaptive(void) {
+	static const struct cgbp_size size = { 1920, 1080 };
+	static const double thresholds[] = { 0, 1, 2, 4, 8, 16 };
+	static const size_t counts[] = { NUM_BALLS, 96 };
+	struct metaballs m;
+	struct cgbp_fb ref, fb;
+	size_t c, i, j, k, evals, differ, worst;
+	double start, elapsed;
+	if(metaballs_bench_fb(&ref, size) < 0)
+		return -1;
+	if(metaballs_bench_fb(&fb, size) < 0) {
+		free(ref.data);
+		return -1;
+	}
+	fprintf(stderr, "%zux%zu rsqrt\n%6s %9s %9s %11s %8s %9s\n", size.w,
+	        size.h, "balls", "threshold", "ms/frame", "evals/pixel", "differ %",
+	        "max diff");
+	for(c = 0; c < sizeof counts / sizeof *counts; c++)
+		for(i = 0; i < sizeof thresholds / sizeof *thresholds; i++) {
+			srand(1);
+			m = (struct metaballs){
+				.num_balls = counts[c], .cutoff = METABALLS_CUTOFF,
+				.adaptive = thresholds[i],
+			};
+			if(metaballs_init(&m, size, "rsqrt", 0) < 0)
+				goto error;
+			start = cgbp_time();
+			for(k = 0; k < METABALLS_BENCH_FRAMES; k++)
+				if(metaballs_frame(&m, size, i == 0 ? &ref : &fb) < 0)
+					goto error;
+			elapsed = (cgbp_time() - start) / METABALLS_BENCH_FRAMES;
+			for(evals = j = 0; j < m.pool.size; j++)
+				evals += m.evals[j];
+			// every pixel is one evaluation without the grid
+			if(i == 0)
+				evals = size.w * size.h;
+			if(i > 0)
+				metaballs_bench_diff(&ref, &fb, &differ, &worst);
+			else
+				differ = worst = 0;
+			fprintf(stderr, "%6zu %9g %9.2f %11.3f %8.2f %9zu\n", counts[c],
+			        thresholds[i], elapsed * 1e3,
+			        (double)evals / (size.w * size.h),
+			        100. * differ / (size.w * size.h), worst);
+			metaballs_cleanup(&m);
+		}
+	free(ref.data);
+	free(fb.data);
+	return 0;
+error:
+	metaballs_cleanup(&m);
+	free(ref.data);
+	free(fb.data);
+	return -1;
+}
+
+/* METABALLS_INCREMENTAL against summing every frame: the first frame,
+ * which is summed from scratch, then the share of tiles damaged and the
+ * time of the frames after, and the difference after all of them. with
+ * every ball moving every frame, the incremental work is twice what
+ * summing the tiles does, so some runs keep all but every nth still. */
+static inline int metaballs_bench_incremental(void) {
+	static const struct cgbp_size size = { 1920, 1080 };
+	static const struct {
+		size_t balls;
+		double cutoff;
+		size_t moving;
+	} runs[] = {
+		{ NUM_BALLS, METABALLS_CUTOFF, 1 }, { 96, METABALLS_CUTOFF, 1 },
+		{ 1536, METABALLS_CUTOFF, 1 }, { 96, 16, 1 }, { 1536, 16, 1 },
+		{ 96, METABALLS_CUTOFF, 16 }, { 1536, 16, 16 },
+	};
+	struct metaballs m[2];
+	struct cgbp_fb fb[2];
+	size_t i, j, k, damaged, differ, worst;
+	double start, elapsed[2], first = 0;
+	if(metaballs_bench_fb(&fb[0], size) < 0)
+		return -1;
+	if(metaballs_bench_fb(&fb[1], size) < 0) {
+		free(fb[0].data);
+		return -1;
+	}
+	fprintf(stderr, "%zux%zu rsqrt, refresh every %d\n%6s %6s %6s %8s %8s "
+	        "%8s %9s %8s %9s\n", size.w, size.h, METABALLS_BENCH_REFRESH,
+	        "balls", "cutoff", "moving", "exact ms", "first ms", "incr ms",
+	        "damaged %", "differ %", "max diff");
+	for(i = 0; i < sizeof runs / sizeof *runs; i++) {
+		// so cleaning up both is fine whichever fails
+		memset(m, 0, sizeof m);
+		for(damaged = j = 0; j < 2; j++) {
+			srand(1);
+			m[j] = (struct metaballs){
+				.num_balls = runs[i].balls, .cutoff = runs[i].cutoff,
+				.refresh = j * METABALLS_BENCH_REFRESH,
+			};
+			if(metaballs_init(&m[j], size, "rsqrt", 0) < 0)
+				goto error;
+			for(k = 0; k < m[j].num_balls; k++)
+				if(k % runs[i].moving != 0)
+					m[j].balls[k].speed_x = m[j].balls[k].speed_y = 0;
+			start = cgbp_time();
+			if(metaballs_frame(&m[j], size, &fb[j]) < 0)
+				goto error;
+			first = cgbp_time() - start;
+			start = cgbp_time();
+			for(k = 0; k < METABALLS_BENCH_FRAMES; k++) {
+				if(metaballs_frame(&m[j], size, &fb[j]) < 0)
+					goto error;
+				damaged += m[j].damaged;
+			}
+			elapsed[j] = (cgbp_time() - start) / METABALLS_BENCH_FRAMES;
+		}
+		metaballs_bench_diff(&fb[0], &fb[1], &differ, &worst);
+		fprintf(stderr, "%6zu %6g %4s%-2zu %8.2f %8.2f %8.2f %9.1f %8.2f "
+		        "%9zu\n", runs[i].balls, runs[i].cutoff,
+		        runs[i].moving > 1 ? "1/" : "", runs[i].moving,
+		        elapsed[0] * 1e3, first * 1e3, elapsed[1] * 1e3,
+		        100. * damaged / METABALLS_BENCH_FRAMES /
+		        (m[1].tiles_w * m[1].tiles_h),
+		        100. * differ / (size.w * size.h), worst);
+		metaballs_cleanup(&m[0]);
+		metaballs_cleanup(&m[1]);
+	}
+	free(fb[0].data);
+	free(fb[1].data);
+	return 0;
+error:
+	metaballs_cleanup(&m[0]);
+	metaballs_cleanup(&m[1]);
+	free(fb[0].data);
+	free(fb[1].data);
+	return -1;
+}
+
+/* CGBP_BENCH: start up time, memory and frame time of both field modes
+ * for a few screen sizes, drawing into memory, then thread scaling, ball
+ * count, the adaptive grid and incremental updates */
+int metaballs_bench(void) {
+	static const struct cgbp_size sizes[] = {
+		{ 1280, 720 }, { 1920, 1080 }, { 3840, 2160 },
+	};
+	static const char *const fields[] = { "table", "rsqrt" };
+	struct metaballs m;
+	struct cgbp_fb fb;
+	size_t i, j, k;
+	double start, init;
+	if(cgbp_kernels_init() < 0)
+		return -1;
+	fprintf(stderr, "%9s %6s %9s %7s %9s\n", "size", "field", "init ms",
+	        "MiB", "ms/frame");
+	for(i = 0; i < sizeof sizes / sizeof *sizes; i++) {
+		if(metaballs_bench_fb(&fb, sizes[i]) < 0)
+			return -1;
+		for(j = 0; j < sizeof fields / sizeof *fields; j++) {
+			srand(1);
+			m = (struct metaballs){ .cutoff = METABALLS_CUTOFF, };
+			start = cgbp_time();
+			if(metaballs_init(&m, sizes[i], fields[j], 0) < 0) {
+				metaballs_cleanup(&m);
+				free(fb.data);
+				return -1;
+			}
+			init = cgbp_time() - start;
+			start = cgbp_time();
+			for(k = 0; k < METABALLS_BENCH_FRAMES; k++)
+				metaballs_frame(&m, sizes[i], &fb);
+			fprintf(stderr, "%4zux%4zu %6s %9.1f %7.1f %9.2f\n", sizes[i].w,
+			        sizes[i].h, fields[j], init * 1e3, m.dist_cache != NULL ?
+			        sizes[i].w * sizes[i].h * sizeof *m.dist_cache / 1048576. :
+			        0., (cgbp_time() - start) * 1e3 / METABALLS_BENCH_FRAMES);
+			metaballs_cleanup(&m);
+		}
+		free(fb.data);
+	}
+	for(j = 0; j < sizeof fields / sizeof *fields; j++)
+		if(metaballs_bench_threads(fields[j]) < 0)
+			return -1;
+	if(metaballs_bench_balls() < 0 || metaballs_bench_adaptive() < 0)
+		return -1;
+	return metaballs_bench_incremental();
 }
 
 int main(void) {
@@ -177,10 +1048,24 @@ int main(void) {
 		.update = metaballs_update,
 		.action = metaballs_action,
 	};
-	struct metaballs m;
+	struct metaballs m = { .cutoff = METABALLS_CUTOFF, };
+	const char *field = getenv("METABALLS_FIELD");
+	const char *env;
 	int ret = EXIT_FAILURE;
 	srand(time(NULL));
-	if(cgbp_init(&c) < 0 || metaballs_init(&m, driver.size(&c)) < 0)
+	if(getenv("CGBP_BENCH") != NULL)
+		return metaballs_bench() < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+	if((env = getenv("METABALLS_BALLS")) != NULL)
+		m.num_balls = strtoul(env, NULL, 10);
+	if((env = getenv("METABALLS_CUTOFF")) != NULL)
+		m.cutoff = strtod(env, NULL);
+	if((env = getenv("METABALLS_ADAPTIVE")) != NULL)
+		m.adaptive = strtod(env, NULL);
+	if((env = getenv("METABALLS_INCREMENTAL")) != NULL)
+		m.refresh = strtoul(env, NULL, 10);
+	if(cgbp_init(&c) < 0 ||
+	  metaballs_init(&m, driver.size(&c), field != NULL ? field :
+	                 METABALLS_DEFAULT_FIELD, 0) < 0)
 		goto error;
 
 	if(cgbp_main(&c, &m, cb) == 0)
@@ -0,0 +1,117 @@
+/* pool.c
+ *
+ * Copyright (c) 2018, mar77i <mar77i at protonmail dot ch>
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license.  See the LICENSE file for details.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+// hand out tasks until none are left; called with the lock held
+static inline void cgbp_pool_drain(struct cgbp_pool *p, size_t id) {
+	size_t task;
+	while(p->next_task < p->num_tasks) {
+		task = p->next_task++;
+		pthread_mutex_unlock(&p->lock);
+		p->fn(p->data, task, id);
+		pthread_mutex_lock(&p->lock);
+	}
+}
+
+static void *cgbp_pool_main(void *arg) {
+	struct cgbp_pool_thread *t = arg;
+	struct cgbp_pool *p = t->p;
+	size_t generation = 0;
+	pthread_mutex_lock(&p->lock);
+	for(;;) {
+		while(!p->quit && p->generation == generation)
+			pthread_cond_wait(&p->start, &p->lock);
+		if(p->quit)
+			break;
+		generation = p->generation;
+		cgbp_pool_drain(p, t->id);
+		if(--p->busy == 0)
+			pthread_cond_signal(&p->done);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+int cgbp_pool_init(struct cgbp_pool *p, size_t size) {
+	const char *env = getenv("CGBP_THREADS");
+	struct cgbp_pool_thread *t;
+	long cpus;
+	int err;
+	memset(p, 0, sizeof *p);
+	if(size == 0 && env != NULL)
+		size = strtoul(env, NULL, 10);
+	if(size == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		size = cpus > 0 ? (size_t)cpus : 1;
+	}
+	p->size = size < CGBP_POOL_MAX ? size : CGBP_POOL_MAX;
+	if(pthread_mutex_init(&p->lock, NULL) != 0 ||
+	  pthread_cond_init(&p->start, NULL) != 0 ||
+	  pthread_cond_init(&p->done, NULL) != 0) {
+		fprintf(stderr, "Error: failed to set up pool synchronization.\n");
+		return -1;
+	}
+	p->sync_set = 1;
+	for(p->num_started = 1; p->num_started < p->size; p->num_started++) {
+		t = &p->threads[p->num_started];
+		t->p = p;
+		t->id = p->num_started;
+		err = pthread_create(&t->thread, NULL, cgbp_pool_main, t);
+		if(err != 0) {
+			fprintf(stderr, "Error: pthread_create: %s\n", strerror(err));
+			cgbp_pool_cleanup(p);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void cgbp_pool_run(struct cgbp_pool *p, size_t num_tasks, cgbp_task *fn,
+                   void *data) {
+	size_t i;
+	if(p->size <= 1) {
+		for(i = 0; i < num_tasks; i++)
+			fn(data, i, 0);
+		return;
+	}
+	pthread_mutex_lock(&p->lock);
+	p->fn = fn;
+	p->data = data;
+	p->num_tasks = num_tasks;
+	p->next_task = 0;
+	p->busy = p->size - 1;
+	p->generation++;
+	pthread_cond_broadcast(&p->start);
+	cgbp_pool_drain(p, 0);
+	while(p->busy > 0)
+		pthread_cond_wait(&p->done, &p->lock);
+	pthread_mutex_unlock(&p->lock);
+}
+
+void cgbp_pool_cleanup(struct cgbp_pool *p) {
+	size_t i;
+	if(!p->sync_set)
+		return;
+	pthread_mutex_lock(&p->lock);
+	p->quit = 1;
+	pthread_cond_broadcast(&p->start);
+	pthread_mutex_unlock(&p->lock);
+	for(i = 1; i < p->num_started; i++)
+		pthread_join(p->threads[i].thread, NULL);
+	pthread_cond_destroy(&p->done);
+	pthread_cond_destroy(&p->start);
+	pthread_mutex_destroy(&p->lock);
+	p->sync_set = 0;
+}
@@ -0,0 +1,45 @@
+/* pool.h
+ *
+ * Copyright (c) 2018, mar77i <mar77i at protonmail dot ch>
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license.  See the LICENSE file for details.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CGBP_POOL_MAX 64
+
+// task runs once per index in [0, num_tasks); worker is in [0, pool size)
+typedef void cgbp_task(void *data, size_t task, size_t worker);
+
+struct cgbp_pool_thread {
+	pthread_t thread;
+	struct cgbp_pool *p;
+	size_t id;
+};
+
+/* a fixed set of threads that run batches of tasks. the calling thread
+ * takes part as worker 0, so a pool of one has no extra threads. */
+struct cgbp_pool {
+	struct cgbp_pool_thread threads[CGBP_POOL_MAX];
+	pthread_mutex_t lock;
+	pthread_cond_t start, done;
+	cgbp_task *fn;
+	void *data;
+	size_t size, num_started, num_tasks, next_task, busy, generation;
+	uint8_t sync_set: 1, quit: 1;
+};
+
+// size 0 means CGBP_THREADS, or the number of online cpus
+int cgbp_pool_init(struct cgbp_pool *p, size_t size);
+void cgbp_pool_run(struct cgbp_pool *p, size_t num_tasks, cgbp_task *fn,
+                   void *data);
+void cgbp_pool_cleanup(struct cgbp_pool *p);
+
+#endif // POOL_H
@@ -0,0 +1,41 @@
+/* raster.c
+ *
+ * Copyright (c) 2018, mar77i <mar77i at protonmail dot ch>
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license.  See the LICENSE file for details.
+ */
+
+#include <stdint.h>
+
+#include "kernel.h"
+#include "raster.h"
+
+CGBP_KERNEL(cgbp_raster_fill_row, (uint32_t *restrict row, uint32_t color,
+                                   size_t n),
+            (row, color, n)) {
+	size_t x;
+	for(x = 0; x < n; x++)
+		row[x] = color;
+}
+
+// whole rows of a raster without padding go as one
+void cgbp_raster_fill(const struct cgbp_raster *r, struct cgbp_rect rect,
+                      uint32_t color) {
+	long y;
+	rect = cgbp_rect_clip(rect, cgbp_raster_rect(r));
+	if(rect.x0 >= rect.x1 || rect.y0 >= rect.y1)
+		return;
+	if(rect.x0 == 0 && rect.x1 == (long)r->w && r->stride == r->w) {
+		cgbp_raster_fill_row(r->data + rect.y0 * r->stride, color,
+		                     (rect.y1 - rect.y0) * r->w);
+		return;
+	}
+	for(y = rect.y0; y < rect.y1; y++)
+		cgbp_raster_fill_row(r->data + y * r->stride + rect.x0, color,
+		                     rect.x1 - rect.x0);
+}
+
+void cgbp_raster_clear(const struct cgbp_raster *r, uint32_t color) {
+	cgbp_raster_fill(r, cgbp_raster_rect(r), color);
+}
@@ -0,0 +1,158 @@
+/* raster.h
+ *
+ * Copyright (c) 2018, mar77i <mar77i at protonmail dot ch>
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license.  See the LICENSE file for details.
+ */
+
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 32 bit pixels, row y from data + y * stride, stride counted in pixels
+struct cgbp_raster {
+	uint32_t *data;
+	size_t w, h, stride;
+};
+
+// the same with 8 bit values, e.g. one channel
+struct cgbp_plane {
+	uint8_t *data;
+	size_t w, h, stride;
+};
+
+// half open: x0 <= x < x1, y0 <= y < y1
+struct cgbp_rect { long x0, y0, x1, y1; };
+
+static inline struct cgbp_rect cgbp_raster_rect(const struct cgbp_raster *r) {
+	return (struct cgbp_rect){ 0, 0, r->w, r->h };
+}
+
+static inline struct cgbp_rect cgbp_plane_rect(const struct cgbp_plane *p) {
+	return (struct cgbp_rect){ 0, 0, p->w, p->h };
+}
+
+static inline struct cgbp_rect cgbp_rect_clip(struct cgbp_rect a,
+                                              struct cgbp_rect b) {
+	return (struct cgbp_rect){
+		a.x0 > b.x0 ? a.x0 : b.x0, a.y0 > b.y0 ? a.y0 : b.y0,
+		a.x1 < b.x1 ? a.x1 : b.x1, a.y1 < b.y1 ? a.y1 : b.y1,
+	};
+}
+
+/* a clipped line as offsets into a raster's data: len pixels from o, each
+ * a step of ua further, and of ub more where rem passes n */
+struct cgbp_line { long o, ua, ub, n, m, rem, len; };
+
+/* the pixels at t = 0..n on the major axis a, from a0 by da, with b on the
+ * minor axis moved m * t / n from b0 towards b0 + db, truncated. [alo,
+ * ahi) and [blo, bhi) clip either axis, and ua and ub are the offsets of
+ * a step along them. the clipped range of t and the remainder at its
+ * start take a division or two per line, then stepping is plain. 0 if
+ * nothing is left. */
+static inline int cgbp_line_run(struct cgbp_line *l, long ua, long ub,
+                                long a0, long b0, long da, long db,
+                                long alo, long ahi, long blo, long bhi) {
+	long n = da < 0 ? -da : da, m = db < 0 ? -db : db, t0, t1, qlo, qhi,
+	     q = 0, rem = 0;
+	if(da < 0) {
+		t0 = a0 - (ahi - 1);
+		t1 = a0 - alo;
+	} else {
+		t0 = alo - a0;
+		t1 = ahi - 1 - a0;
+	}
+	t0 = t0 > 0 ? t0 : 0;
+	t1 = t1 < n ? t1 : n;
+	// the steps along b that stay in [blo, bhi), then when they're taken
+	if(db < 0) {
+		qlo = b0 - (bhi - 1);
+		qhi = b0 - blo;
+	} else {
+		qlo = blo - b0;
+		qhi = bhi - 1 - b0;
+	}
+	if(qlo > m || qhi < 0 || qlo > qhi)
+		return 0;
+	if(qlo > 0 && (qlo * n + m - 1) / m > t0)
+		t0 = (qlo * n + m - 1) / m;
+	if(qhi < m && ((qhi + 1) * n + m - 1) / m - 1 < t1)
+		t1 = ((qhi + 1) * n + m - 1) / m - 1;
+	if(t0 > t1)
+		return 0;
+	if(t0 > 0) {
+		q = m * t0 / n;
+		rem = m * t0 % n;
+	}
+	*l = (struct cgbp_line){
+		(da < 0 ? a0 - t0 : a0 + t0) * ua + (db < 0 ? b0 - q : b0 + q) * ub,
+		da < 0 ? -ua : ua, db < 0 ? -ub : ub, n, m, rem, t1 - t0 + 1,
+	};
+	return 1;
+}
+
+/* the line from (x0, y0) to (x1, y1), both ends included, where it crosses
+ * clip, in data of the given stride. along the longer axis, the shorter one
+ * moves by its delta times the distance from the start over the longer
+ * delta, truncated; which pixels don't depend on clip, so a line drawn
+ * piecewise in several clips comes out as if drawn at once. */
+static inline int cgbp_line_clip(struct cgbp_line *l, size_t stride,
+                                 struct cgbp_rect clip, long x0, long y0,
+                                 long x1, long y1) {
+	long dx = x1 - x0, dy = y1 - y0;
+	if((dx < 0 ? -dx : dx) >= (dy < 0 ? -dy : dy))
+		return cgbp_line_run(l, 1, stride, x0, y0, dx, dy,
+		                     clip.x0, clip.x1, clip.y0, clip.y1);
+	return cgbp_line_run(l, stride, 1, y0, x0, dy, dx,
+	                     clip.y0, clip.y1, clip.x0, clip.x1);
+}
+
+// the minor step is taken about at random, so it's done without a branch
+static inline void cgbp_line_step(struct cgbp_line *l) {
+	long step;
+	l->rem += l->m;
+	step = -(long)(l->rem >= l->n);
+	l->rem -= l->n & step;
+	l->o += l->ua + (l->ub & step);
+}
+
+/* see cgbp_line_clip; inline, as trajectories are drawn as many short
+ * segments */
+static inline void cgbp_raster_line(const struct cgbp_raster *r,
+                                    struct cgbp_rect clip, long x0, long y0,
+                                    long x1, long y1, uint32_t color) {
+	struct cgbp_line l;
+	long i;
+	if(!cgbp_line_clip(&l, r->stride,
+	                   cgbp_rect_clip(clip, cgbp_raster_rect(r)),
+	                   x0, y0, x1, y1))
+		return;
+	for(i = 0; i < l.len; i++) {
+		r->data[l.o] = color;
+		cgbp_line_step(&l);
+	}
+}
+
+static inline void cgbp_plane_line(const struct cgbp_plane *p,
+                                   struct cgbp_rect clip, long x0, long y0,
+                                   long x1, long y1, uint8_t value) {
+	struct cgbp_line l;
+	long i;
+	if(!cgbp_line_clip(&l, p->stride,
+	                   cgbp_rect_clip(clip, cgbp_plane_rect(p)),
+	                   x0, y0, x1, y1))
+		return;
+	for(i = 0; i < l.len; i++) {
+		p->data[l.o] = value;
+		cgbp_line_step(&l);
+	}
+}
+
+void cgbp_raster_fill(const struct cgbp_raster *r, struct cgbp_rect rect,
+                      uint32_t color);
+void cgbp_raster_clear(const struct cgbp_raster *r, uint32_t color);
+
+#endif // RASTER_H
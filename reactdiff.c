@@ -7,230 +7,1205 @@
  * of the ISC license.  See the LICENSE file for details.
  */
 
+#include <errno.h>
 #include <limits.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "cgbp.h"
 #include "hsv.h"
+#include "kernel.h"
+#include "pool.h"
 
 #define STEP_DIV 256
 #define STEPS_PER_FRAME 8
+// steps taken per band before the halos are exchanged
+#define RD_BLOCK_STEPS STEPS_PER_FRAME
+// aim for a band's scratch planes to fit in this much cache
+#define RD_BAND_BYTES (1 << 20)
+#define RD_MIN_BAND 16
+// two cell planes per scratch set; the rkc stepper rotates three sets
+#define RD_SCRATCH_PLANES 6
+// the rkc damping, and a bound on the stiffest eigenvalue of the
+// diffusion (-1.6 for the 9 point stencil) plus the reaction
+#define RD_RKC_DAMPING .05
+#define RD_RKC_LAMBDA 2.6
+#define RD_RKC_MAX_STAGES 32
+// activity tracking works on square tiles of this many cells
+#define RD_TILE 32
+// seconds between background checkpoints, unless REACTDIFF_CHECKPOINT says
+#define RD_CHECKPOINT_INTERVAL 60
 
 #define SIGN(x) ((x) < 0 ? -1 : 1)
 #define ABS(x) ((long)(x) < 0 ? -((long)(x)) : ((long)(x)))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define TO_RGB(r, g, b) \
 	(((uint32_t)(r) << 16) | ((uint32_t)(g) << 8) | (uint32_t)(b))
 
+/* cell representations: the original 32 bit fixed point, a 16 bit one at
+ * half the bandwidth, and floats. RD_UNIT stands for a concentration of 1.
+ * REACTDIFF_REPR picks one at run time. */
+#ifndef RD_DEFAULT_REPR
+#define RD_DEFAULT_REPR "int32"
+#endif
+
 #define RINT int32_t
 #define RINT_UNIT 49152
 #define RINT_MUL(a, b) ((intmax_t)(a) * (b) / RINT_UNIT)
+#define RINT16_SHIFT 15
+#define RINT16_UNIT (1 << RINT16_SHIFT)
 
-struct reactdiff {
-	struct rdxel {
-		RINT a, b;
-	} *abmap;
-	RINT da, db, feed, kill;
-	size_t l, t, w, h;
+struct reactdiff;
+
+struct reactdiff_repr {
+	const char *name;
+	size_t size, lut_bins;
+	double unit;
+	// rkc_band is NULL for the fixed point types
+	cgbp_task *band, *rkc_band;
+	void (*set)(void *plane, size_t i, double v);
+	double (*get)(const void *plane, size_t i);
 };
 
-int reactdiff_init(struct cgbp *c, struct reactdiff *r) {
-	struct cgbp_size size = driver.size(c);
-	size_t i, x, y;
-	r->w = MIN(600, size.w);
-	r->h = MIN(600, size.h);
-	r->l = (size.w - r->w) / 2;
-	r->t = (size.h - r->h) / 2;
-	r->abmap = malloc(sizeof *r->abmap * r->w * r->h);
-	if(r->abmap == NULL) {
-		perror("malloc");
-		return -1;
-	}
-	r->da = RINT_UNIT;
-	r->db = .5 * RINT_UNIT;
-/*
-	r->feed = .055 * RINT_UNIT;
-	r->kill = .062 * RINT_UNIT;
-#define A_INIT RINT_UNIT
-#define B_INIT 0
-#define SEED_SIZE 20
-*/
-/*
-	r->feed = .0207 * RINT_UNIT;
-	r->kill = .0509 * RINT_UNIT;
-#define A_INIT RINT_UNIT
-#define B_INIT 0
-#define SEED_SIZE 20
-*/
-/*
+struct reactdiff_preset {
+	double feed, kill, a, b;
+	size_t seed_size;
+	// a and b scale a random initial state rather than set it
+	uint8_t random;
+};
+
+static const struct reactdiff_preset reactdiff_presets[] = {
+	{ .055, .062, 1, 0, 20, 0 },
+	{ .0207, .0509, 1, 0, 20, 0 },
 	// this one features spiral waves when it doesn't die off
-	r->feed = .012 * RINT_UNIT;
-	r->kill = .041 * RINT_UNIT;
-#define A_INIT ((float)rand() * RINT_UNIT / RAND_MAX)
-#define B_INIT ((float)rand() * RINT_UNIT * .2 / RAND_MAX)
-#define SEED_SIZE 0
-*/
+	{ .012, .041, 1, .2, 0, 1 },
 	// absolutely gorgeous oscillation
-	r->feed = .01 * RINT_UNIT;
-	r->kill = .0325 * RINT_UNIT;
-#define A_INIT ((float)rand() * .78 * RINT_UNIT / RAND_MAX)
-#define B_INIT ((float)rand() * .2 * RINT_UNIT / RAND_MAX)
-#define SEED_SIZE 0
-/*
-	r->feed = .011 * RINT_UNIT;
-	r->kill = .035 * RINT_UNIT;
-#define A_INIT ((float)rand() * RINT_UNIT * .84 / RAND_MAX)
-#define B_INIT ((float)rand() * RINT_UNIT * .18 / RAND_MAX)
-#define SEED_SIZE 0
-*/
-	for(i = 0; i < r->w * r->h; i++) {
-		r->abmap[i].a = A_INIT;
-		r->abmap[i].b = B_INIT;
-	}
-	for(y = (r->h - SEED_SIZE) / 2; y < (r->h + SEED_SIZE) / 2; y++)
-		for(x = (r->w - SEED_SIZE) / 2; x < (r->w + SEED_SIZE) / 2; x++) {
-			r->abmap[y * r->w + x].a = 0;
-			r->abmap[y * r->w + x].b = RINT_UNIT;
-		}
-	for(y = 0; (size_t)y < size.h; y++)
-		for(x = 0; (size_t)x < size.w; x++)
-			driver.set_pixel(c, x, y, 0x333333);
-	return 0;
-}
-
-#define LAPLACE(v, p, x) ( \
-	+ ((v)[0].x + (v)[2].x + (v)[5].x + (v)[7].x) / 20 + \
-	+ ((v)[1].x + (v)[3].x + (v)[4].x + (v)[6].x) / 5 \
-	- (p).x \
-)
-static inline struct rdxel laplace(struct rdxel *neighbors, struct rdxel *p) {
-	return (struct rdxel){
-		.a = LAPLACE(neighbors, *p, a),
-		.b = LAPLACE(neighbors, *p, b),
-	};
+	{ .01, .0325, .78, .2, 0, 1 },
+	{ .011, .035, .84, .18, 0, 1 },
+};
+#define RD_DEFAULT_PRESET 3
+#define RD_NUM_PRESETS (sizeof reactdiff_presets / sizeof *reactdiff_presets)
+
+/* snapshot files: this header, zero padded to RD_SNAP_HEADER bytes, then
+ * the grid memory exactly as it is laid out in struct reactdiff, so it can
+ * be mapped in place. */
+#define RD_SNAP_MAGIC "cgbprd\n"
+#define RD_SNAP_VERSION 1
+#define RD_SNAP_HEADER 4096
+
+struct reactdiff_snap {
+	char magic[8];
+	uint32_t version, cell_size;
+	char repr[16];
+	uint64_t w, h, cur;
+	double da, db, feed, kill;
+};
+
+/* a and b live in separate planes with a one cell ghost border, padded
+ * the same in the shared grid and in each worker's scratch. the grid is
+ * cut into bands of rows; a worker copies its band plus block rows of halo
+ * above and below into scratch, takes block steps there and writes only
+ * the final step back, so the grid is swept once per block instead of once
+ * per step. the last step of a frame also colours its rows into out. */
+struct reactdiff {
+	struct cgbp_pool pool;
+	const struct reactdiff_repr *repr;
+	const struct cgbp_fb *out;
+	void *mem, *a[2], *b[2], *scratch;
+	uint32_t *lut, *lines;
+	// fractions of the unit
+	double da, db, feed, kill;
+	size_t l, t, w, h, pitch, cur, block, band_h, num_bands, scratch_len,
+	       steps;
+	/* with rkc_stages set, steps are rkc steps of rkc_dt euler steps each;
+	 * rkc_time is time owed to the next one */
+	size_t rkc_stages;
+	double rkc_dt, rkc_time, rkc_mu[RD_RKC_MAX_STAGES + 1],
+	       rkc_nu[RD_RKC_MAX_STAGES + 1], rkc_mut[RD_RKC_MAX_STAGES + 1];
+	/* with sleep set, tiles whose cells changed by no more than that in a
+	 * block's last step, like their neighbours, sit out until a neighbour
+	 * changes */
+	uint8_t *tile_sleep, *tile_next, *tile_active;
+	double sleep;
+	size_t tiles_w, tiles_h, tile_steps, tile_skipped;
+	// set when mem is a mapped snapshot
+	void *map;
+	size_t map_len;
+	// REACTDIFF_SNAPSHOT, and the checkpoint being written, if any
+	const char *snap_path;
+	char *snap_tmp;
+	double snap_interval, snap_last;
+	pid_t snap_pid;
+};
+
+#define RD_AT(r, plane, x, y) ((plane)[((y) + 1) * (r)->pitch + (x) + 1])
+
+/* RINT_MUL for 0 <= a, b <= RINT_UNIT: the product fits 32 unsigned bits,
+ * which keeps the whole stencil in 32 bit lanes */
+static inline RINT rint_mulu(uint32_t a, uint32_t b) {
+	return a * b / RINT_UNIT;
 }
 
-static inline void get_neighbors(struct reactdiff *r, struct rdxel *neighbors,
-                                 struct rdxel *pline, struct rdxel *pleft,
-                                 struct rdxel *firstline, size_t x, size_t y) {
-	size_t lc = r->w - 1, lr = r->h - 1;
-	struct rdxel *row = &r->abmap[y * r->w],
-	             *row_above = y == 0 ? &r->abmap[lr * r->w] : pline,
-	             *row_beneath = y == lr ? firstline : row + r->w;
-	size_t column_left = x == 0 ? lc : x - 1,
-	       column_right = x == lc ? 0 : x + 1;
-	neighbors[0] = row_above[column_left];
-	neighbors[1] = row_above[x];
-	neighbors[2] = row_above[column_right];
-	neighbors[3] = x == 0 ? row[lc] : *pleft;
-	neighbors[4] = row[column_right];
-	neighbors[5] = row_beneath[column_left];
-	neighbors[6] = row_beneath[x];
-	neighbors[7] = row_beneath[column_right];
-}
-
-int reactdiff_step(struct reactdiff *r) {
-	struct rdxel pline1[r->w + 1], pline2[r->w + 1], *pline_new, *pline_old,
-	             *pleft_new, *pleft_old, *tmp, lab, neighbors[8], *p, *row;
-	struct rdxel firstline[r->w];
-	size_t x, y;
-	RINT abb;
-	pline_new = pline1;
-	pline_old = pline2;
-	pleft_new = &pline1[r->w];
-	pleft_old = &pline2[r->w];
-	for(x = 0; x < r->w; x++)
-		firstline[x] = r->abmap[x];
-	for(y = 0; y < r->h; y++) {
-		row = &r->abmap[y * r->w];
-		for(x = 0; x < r->w; x++)
-			pline_new[x] = row[x];
-		for(x = 0; x < r->w; x++) {
-			p = &row[x];
-			*pleft_new = *p;
-			get_neighbors(r, neighbors, pline_old, pleft_old, firstline, x, y);
-			lab = laplace(neighbors, p);
-			abb = RINT_MUL(p->a, RINT_MUL(p->b, p->b));
-			p->a += RINT_MUL(r->da, lab.a) - abb + RINT_MUL(r->feed, RINT_UNIT - p->a);
-			p->b += RINT_MUL(r->db, lab.b) + abb - RINT_MUL(r->kill + r->feed, p->b);
-			if(p->a < 0)
-				p->a = 0;
-			else if(p->a >= RINT_UNIT)
-				p->a = RINT_UNIT - 1;
-			if(p->b < 0)
-				p->b = 0;
-			else if(p->b >= RINT_UNIT)
-				p->b = RINT_UNIT - 1;
-
-			tmp = pleft_new;
-			pleft_new = pleft_old;
-			pleft_old = tmp;
-		}
-		tmp = pline_new;
-		pline_new = pline_old;
-		pline_old = tmp;
-	}
-	return 0;
-}
-
-static inline uint32_t colorify(struct rdxel ptr) {
+// and for |b| <= RINT_UNIT, truncating towards zero like RINT_MUL does
+static inline RINT rint_muls(uint32_t a, RINT b) {
+	return b < 0 ? -rint_mulu(a, -b) : rint_mulu(a, b);
+}
+
+static inline int32_t rint16_mulu(uint32_t a, uint32_t b) {
+	return a * b >> RINT16_SHIFT;
+}
+
+static inline int32_t rint16_muls(uint32_t a, int32_t b) {
+	return b < 0 ? -rint16_mulu(a, -b) : rint16_mulu(a, b);
+}
+
+#define RD_NAME int32
+#define RD_T RINT
+#define RD_W RINT
+#define RD_UNIT RINT_UNIT
+#define RD_MAX (RINT_UNIT - 1)
+#define RD_MIN 1
+#define RD_MULU(a, b) rint_mulu(a, b)
+#define RD_MULS(a, b) rint_muls(a, b)
+#define RD_DIV(x, d) ((x) / (d))
+#define RD_LUT_BINS (RINT_UNIT >> 8)
+#define RD_LUT_INDEX(x) ((x) >> 8)
+#include "reactdiff_repr.h"
+
+#define RD_NAME int16
+#define RD_T int16_t
+#define RD_W int32_t
+#define RD_UNIT RINT16_UNIT
+#define RD_MAX (RINT16_UNIT - 1)
+#define RD_MIN 1
+#define RD_MULU(a, b) rint16_mulu(a, b)
+#define RD_MULS(a, b) rint16_muls(a, b)
+#define RD_DIV(x, d) ((x) / (d))
+#define RD_LUT_BINS (RINT16_UNIT >> 7)
+#define RD_LUT_INDEX(x) ((x) >> 7)
+#include "reactdiff_repr.h"
+
+#define RD_NAME float32
+#define RD_T float
+#define RD_W float
+#define RD_UNIT 1.0f
+#define RD_MAX 0x1.fffffep-1f
+// flushed well before subnormals, which are slow
+#define RD_MIN 0x1p-24f
+#define RD_MULU(a, b) ((a) * (b))
+#define RD_MULS(a, b) ((a) * (b))
+#define RD_DIV(x, d) ((x) * (1.0f / (d)))
+#define RD_LUT_BINS 256
+#define RD_LUT_INDEX(x) ((int32_t)((x) * RD_LUT_BINS))
+#define RD_FLOAT
+#include "reactdiff_repr.h"
+
+// the reference for the accuracy benchmark
+#define RD_NAME float64
+#define RD_T double
+#define RD_W double
+#define RD_UNIT 1.0
+#define RD_MAX 0x1.fffffffffffffp-1
+#define RD_MIN 0x1p-53
+#define RD_MULU(a, b) ((a) * (b))
+#define RD_MULS(a, b) ((a) * (b))
+#define RD_DIV(x, d) ((x) * (1.0 / (d)))
+#define RD_LUT_BINS 256
+#define RD_LUT_INDEX(x) ((int32_t)((x) * RD_LUT_BINS))
+#define RD_FLOAT
+#include "reactdiff_repr.h"
+
+static const struct reactdiff_repr *const reactdiff_reprs[] = {
+	&reactdiff_repr_int16,
+	&reactdiff_repr_int32,
+	&reactdiff_repr_float32,
+	&reactdiff_repr_float64,
+};
+#define RD_NUM_REPRS (sizeof reactdiff_reprs / sizeof *reactdiff_reprs)
+
+static inline const struct reactdiff_repr *reactdiff_find_repr(
+		const char *name) {
+	size_t i;
+	for(i = 0; i < RD_NUM_REPRS; i++)
+		if(strcmp(name, reactdiff_reprs[i]->name) == 0)
+			return reactdiff_reprs[i];
+	fprintf(stderr, "Error: REACTDIFF_REPR: unknown representation \"%s\".\n",
+	        name);
+	return NULL;
+}
+
+static inline uint32_t reactdiff_colorify(double a, double b) {
 /*
 	uint8_t a = (intmax_t)(ptr.a > ptr.b ? ptr.a - ptr.b : 0) * 0xff /
 	            RINT_UNIT;
 	return TO_RGB(a, a, a);
 */
-	double rgb[3] = { 0 };
-	hsv_to_rgb(rgb, (double)ptr.a / RINT_UNIT, 1.0, (double)ptr.b / RINT_UNIT);
+	double rgb[3];
+	hsv_to_rgb_vec(rgb, a, 1.0, b);
 	return TO_RGB(rgb[0] * 0xff, rgb[1] * 0xff, rgb[2] * 0xff);
 }
 
-void reactdiff_draw(struct cgbp *c, struct reactdiff *r) {
+// sampled at the middle of each bin; opaque so it suits ARGB8888 as well
+static inline int reactdiff_lut(struct reactdiff *r) {
+	size_t i, j, n = r->repr->lut_bins;
+	r->lut = malloc(sizeof *r->lut * n * n);
+	if(r->lut == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	for(i = 0; i < n; i++)
+		for(j = 0; j < n; j++)
+			r->lut[i * n + j] = 0xff000000 |
+				reactdiff_colorify((i + .5) / n, (j + .5) / n);
+	return 0;
+}
+
+// the band height and scratch size depend on the pool size
+static inline int reactdiff_bands(struct reactdiff *r) {
+	size_t rows = RD_BAND_BYTES / (RD_SCRATCH_PLANES * r->repr->size * r->pitch);
+	r->band_h = rows > 2 * r->block ? rows - 2 * r->block : 0;
+	// at least one band per worker, without drowning in halo rows
+	r->band_h = MIN(r->band_h, (r->h + r->pool.size - 1) / r->pool.size);
+	r->band_h = MIN(MAX(r->band_h, MAX(RD_MIN_BAND, r->block)), r->h);
+	// whole tile rows, so no two bands note changes for the same tile
+	if(r->tile_sleep != NULL)
+		r->band_h = MIN(MAX(r->band_h / RD_TILE, 1) * RD_TILE, r->h);
+	r->num_bands = (r->h + r->band_h - 1) / r->band_h;
+	r->scratch_len = RD_SCRATCH_PLANES * r->pitch * (r->band_h + 2 * r->block);
+	r->scratch = malloc(r->repr->size * r->scratch_len * r->pool.size);
+	r->lines = malloc(sizeof *r->lines * r->w * r->pool.size);
+	if(r->scratch == NULL || r->lines == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	return 0;
+}
+
+static inline void reactdiff_seed(struct reactdiff *r,
+                                  const struct reactdiff_preset *p) {
+	double unit = r->repr->unit;
+	size_t x, y, i;
+	r->da = 1;
+	r->db = .5;
+	r->feed = p->feed;
+	r->kill = p->kill;
+	for(y = 0; y < r->h; y++)
+		for(x = 0; x < r->w; x++) {
+			i = (y + 1) * r->pitch + x + 1;
+			if(p->random) {
+				r->repr->set(r->a[0], i,
+				             (double)(float)rand() * p->a * unit / RAND_MAX);
+				r->repr->set(r->b[0], i,
+				             (double)(float)rand() * p->b * unit / RAND_MAX);
+			} else {
+				r->repr->set(r->a[0], i, p->a * unit);
+				r->repr->set(r->b[0], i, p->b * unit);
+			}
+		}
+	for(y = (r->h - p->seed_size) / 2; y < (r->h + p->seed_size) / 2; y++)
+		for(x = (r->w - p->seed_size) / 2; x < (r->w + p->seed_size) / 2; x++) {
+			i = (y + 1) * r->pitch + x + 1;
+			r->repr->set(r->a[0], i, 0);
+			r->repr->set(r->b[0], i, unit);
+		}
+}
+
+/* switch to rkc steps of dt, taking the fewest stages whose stability
+ * interval (w0 + 1) / w1 covers dt * RD_RKC_LAMBDA. with b_j = 1 / T_j(w0),
+ * mu_j + nu_j = 1, so stages never need to look back at the step's start. */
+static inline int reactdiff_rkc_init(struct reactdiff *r, double dt) {
+	double w0, w1, t[RD_RKC_MAX_STAGES + 1], dt_[RD_RKC_MAX_STAGES + 1];
+	size_t s, j;
+	for(s = 1; s <= RD_RKC_MAX_STAGES; s++) {
+		w0 = 1 + RD_RKC_DAMPING / (s * s);
+		t[0] = 1;
+		t[1] = w0;
+		dt_[0] = 0;
+		dt_[1] = 1;
+		for(j = 2; j <= s; j++) {
+			t[j] = 2 * w0 * t[j - 1] - t[j - 2];
+			dt_[j] = 2 * t[j - 1] + 2 * w0 * dt_[j - 1] - dt_[j - 2];
+		}
+		w1 = t[s] / dt_[s];
+		if((w0 + 1) / w1 >= dt * RD_RKC_LAMBDA)
+			break;
+	}
+	if(s > RD_RKC_MAX_STAGES) {
+		fprintf(stderr, "Error: rkc: dt %g needs too many stages.\n", dt);
+		return -1;
+	}
+	r->rkc_stages = s;
+	r->rkc_dt = dt;
+	r->rkc_time = 0;
+	r->rkc_mu[1] = 1;
+	r->rkc_nu[1] = 0;
+	r->rkc_mut[1] = dt * w1 / w0;
+	for(j = 2; j <= s; j++) {
+		r->rkc_mu[j] = 2 * w0 * t[j - 1] / t[j];
+		r->rkc_nu[j] = -t[j - 2] / t[j];
+		r->rkc_mut[j] = dt * 2 * w1 * t[j - 1] / t[j];
+	}
+	return 0;
+}
+
+static inline size_t reactdiff_mem_size(const struct reactdiff *r) {
+	return 4 * r->repr->size * (r->w + 2) * (r->h + 2);
+}
+
+// everything but the cell values, given repr, w and h; mem may be mapped
+static inline int reactdiff_alloc(struct reactdiff *r, size_t threads) {
+	size_t i, plane = reactdiff_mem_size(r) / 4;
+	r->pitch = r->w + 2;
+	r->block = MAX(RD_BLOCK_STEPS, r->rkc_stages);
+	r->out = NULL;
+	if(r->mem == NULL && (r->mem = malloc(4 * plane)) == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	for(i = 0; i < 2; i++) {
+		r->a[i] = (uint8_t*)r->mem + 2 * i * plane;
+		r->b[i] = (uint8_t*)r->a[i] + plane;
+	}
+	if(r->sleep > 0) {
+		r->tiles_w = (r->w + RD_TILE - 1) / RD_TILE;
+		r->tiles_h = (r->h + RD_TILE - 1) / RD_TILE;
+		r->tile_sleep = calloc(r->tiles_w * r->tiles_h, 1);
+		r->tile_next = calloc(r->tiles_w * r->tiles_h, 1);
+		r->tile_active = calloc(r->tiles_w * r->tiles_h, 1);
+		if(r->tile_sleep == NULL || r->tile_next == NULL ||
+		  r->tile_active == NULL) {
+			perror("calloc");
+			return -1;
+		}
+	}
+	if(cgbp_pool_init(&r->pool, threads) < 0 || reactdiff_bands(r) < 0 ||
+	  reactdiff_lut(r) < 0)
+		return -1;
+	return 0;
+}
+
+int reactdiff_setup(struct reactdiff *r, size_t w, size_t h, size_t threads,
+                    const struct reactdiff_repr *repr,
+                    const struct reactdiff_preset *preset) {
+	r->repr = repr;
+	r->w = w;
+	r->h = h;
+	r->cur = 0;
+	if(reactdiff_alloc(r, threads) < 0)
+		return -1;
+	reactdiff_seed(r, preset);
+	return 0;
+}
+
+/* map a snapshot privately as the grid: pages are read in as the first
+ * step touches them and never written back */
+static inline int reactdiff_restore(struct reactdiff *r, const char *path) {
+	struct reactdiff_snap snap;
+	struct stat st;
+	size_t i;
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		perror(path);
+		return -1;
+	}
+	if(fstat(fd, &st) < 0) {
+		perror("fstat");
+		goto error;
+	}
+	if((size_t)st.st_size < RD_SNAP_HEADER ||
+	  read(fd, &snap, sizeof snap) != sizeof snap ||
+	  memcmp(snap.magic, RD_SNAP_MAGIC, sizeof snap.magic) != 0) {
+		fprintf(stderr, "Error: %s: not a reactdiff snapshot.\n", path);
+		goto error;
+	}
+	if(snap.version != RD_SNAP_VERSION) {
+		fprintf(stderr, "Error: %s: snapshot version %u, expected %d.\n",
+		        path, snap.version, RD_SNAP_VERSION);
+		goto error;
+	}
+	snap.repr[sizeof snap.repr - 1] = '\0';
+	r->repr = NULL;
+	for(i = 0; i < RD_NUM_REPRS; i++)
+		if(strcmp(snap.repr, reactdiff_reprs[i]->name) == 0 &&
+		  snap.cell_size == reactdiff_reprs[i]->size)
+			r->repr = reactdiff_reprs[i];
+	r->w = snap.w;
+	r->h = snap.h;
+	if(r->repr == NULL || r->w < 2 || r->h < 2 || snap.cur > 1 ||
+	  (size_t)st.st_size != RD_SNAP_HEADER + reactdiff_mem_size(r)) {
+		fprintf(stderr, "Error: %s: corrupt snapshot.\n", path);
+		goto error;
+	}
+	r->map_len = st.st_size;
+	r->map = mmap(NULL, r->map_len, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if(r->map == MAP_FAILED) {
+		perror("mmap");
+		r->map = NULL;
+		goto error;
+	}
+	close(fd);
+	r->mem = (uint8_t*)r->map + RD_SNAP_HEADER;
+	r->cur = snap.cur;
+	r->da = snap.da;
+	r->db = snap.db;
+	r->feed = snap.feed;
+	r->kill = snap.kill;
+	fprintf(stderr, "restored %zux%zu %s grid from %s\n", r->w, r->h,
+	        r->repr->name, path);
+	return 0;
+error:
+	close(fd);
+	return -1;
+}
+
+static inline int reactdiff_write_all(int fd, const void *buf, size_t len) {
+	const uint8_t *p = buf;
+	ssize_t ret;
+	while(len > 0) {
+		ret = write(fd, p, len);
+		if(ret < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/* write to a temporary file next to the snapshot and rename it over, so a
+ * crash never leaves a torn one. also runs in the checkpoint child, so
+ * nothing here may allocate. */
+static int reactdiff_snapshot(const struct reactdiff *r) {
+	uint8_t header[RD_SNAP_HEADER] = { 0 };
+	struct reactdiff_snap snap = {
+		RD_SNAP_MAGIC, RD_SNAP_VERSION, r->repr->size, { 0 },
+		r->w, r->h, r->cur, r->da, r->db, r->feed, r->kill,
+	};
+	int fd;
+	strncpy(snap.repr, r->repr->name, sizeof snap.repr - 1);
+	memcpy(header, &snap, sizeof snap);
+	fd = open(r->snap_tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	if(fd < 0) {
+		perror(r->snap_tmp);
+		return -1;
+	}
+	if(reactdiff_write_all(fd, header, sizeof header) < 0 ||
+	  reactdiff_write_all(fd, r->mem, reactdiff_mem_size(r)) < 0 ||
+	  fsync(fd) < 0) {
+		perror(r->snap_tmp);
+		close(fd);
+		return -1;
+	}
+	if(close(fd) < 0 || rename(r->snap_tmp, r->snap_path) < 0) {
+		perror(r->snap_path);
+		return -1;
+	}
+	return 0;
+}
+
+// reap a finished checkpoint; with wait set, block until it is done
+static inline void reactdiff_checkpoint_poll(struct reactdiff *r, int wait) {
+	int status;
+	if(r->snap_pid <= 0 ||
+	  waitpid(r->snap_pid, &status, wait ? 0 : WNOHANG) == 0)
+		return;
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+		fprintf(stderr, "checkpoint to %s failed\n", r->snap_path);
+	r->snap_pid = 0;
+}
+
+/* the forked child gets a copy-on-write view of the grid as of now and
+ * writes it out while the parent keeps stepping */
+static inline void reactdiff_checkpoint(struct reactdiff *r) {
+	if(r->snap_path == NULL || r->snap_pid > 0)
+		return;
+	r->snap_last = cgbp_time();
+	r->snap_pid = fork();
+	if(r->snap_pid < 0)
+		perror("fork");
+	else if(r->snap_pid == 0)
+		_exit(reactdiff_snapshot(r) < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static inline int reactdiff_check_rkc(const struct reactdiff_repr *repr,
+                                      const struct reactdiff *r) {
+	if(r->rkc_stages == 0 || repr->rkc_band != NULL)
+		return 0;
+	fprintf(stderr, "Error: REACTDIFF_RKC: %s cells have no rkc stepper.\n",
+	        repr->name);
+	return -1;
+}
+
+/* REACTDIFF_SNAPSHOT names a snapshot file: an existing one is resumed,
+ * and the grid is checkpointed to it periodically and on exit */
+static inline int reactdiff_init_snapshot(struct reactdiff *r) {
+	const char *env = getenv("REACTDIFF_CHECKPOINT");
+	r->snap_path = getenv("REACTDIFF_SNAPSHOT");
+	if(r->snap_path == NULL)
+		return 0;
+	r->snap_interval = env != NULL ? strtod(env, NULL) : RD_CHECKPOINT_INTERVAL;
+	r->snap_last = cgbp_time();
+	r->snap_tmp = malloc(strlen(r->snap_path) + sizeof ".tmp");
+	if(r->snap_tmp == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	strcpy(r->snap_tmp, r->snap_path);
+	strcat(r->snap_tmp, ".tmp");
+	return 0;
+}
+
+int reactdiff_init(struct cgbp *c, struct reactdiff *r) {
 	struct cgbp_size size = driver.size(c);
-	struct rdxel *row;
-	size_t x, y;
-	for(y = 0; y < r->h; y++) {
-		row = &r->abmap[y * r->w];
-		for(x = 0; x < r->w; x++)
-			if(r->l + x < size.w && r->t + y < size.h)
-				driver.set_pixel(c, r->l + x, r->t + y, colorify(row[x]));
+	const struct reactdiff_repr *repr;
+	const char *env = getenv("REACTDIFF_REPR");
+	const char *rkc = getenv("REACTDIFF_RKC");
+	const char *sleep = getenv("REACTDIFF_SLEEP");
+	size_t x, y, preset = RD_DEFAULT_PRESET;
+	if(reactdiff_init_snapshot(r) < 0)
+		return -1;
+	if(rkc != NULL && strtod(rkc, NULL) <= 0) {
+		fprintf(stderr, "Error: REACTDIFF_RKC: expected a positive dt.\n");
+		return -1;
+	}
+	if(sleep != NULL && (r->sleep = strtod(sleep, NULL)) <= 0) {
+		fprintf(stderr, "Error: REACTDIFF_SLEEP: expected a positive "
+		        "threshold.\n");
+		return -1;
+	}
+	if(sleep != NULL && rkc != NULL) {
+		fprintf(stderr, "Error: REACTDIFF_SLEEP: not supported with "
+		        "REACTDIFF_RKC.\n");
+		return -1;
+	}
+	if(rkc != NULL && reactdiff_rkc_init(r, strtod(rkc, NULL)) < 0)
+		return -1;
+	if(r->snap_path != NULL && access(r->snap_path, F_OK) == 0) {
+		if(reactdiff_restore(r, r->snap_path) < 0 ||
+		  reactdiff_check_rkc(r->repr, r) < 0 || reactdiff_alloc(r, 0) < 0)
+			return -1;
+		if(r->w > size.w || r->h > size.h) {
+			fprintf(stderr, "Error: %s: %zux%zu grid does not fit the "
+			        "display.\n", r->snap_path, r->w, r->h);
+			return -1;
+		}
+	} else {
+		repr = reactdiff_find_repr(env != NULL ? env : RD_DEFAULT_REPR);
+		if(repr == NULL || reactdiff_check_rkc(repr, r) < 0)
+			return -1;
+		env = getenv("REACTDIFF_PRESET");
+		if(env != NULL &&
+		  (preset = strtoul(env, NULL, 10)) >= RD_NUM_PRESETS) {
+			fprintf(stderr, "Error: REACTDIFF_PRESET: expected 0 to %zu.\n",
+			        RD_NUM_PRESETS - 1);
+			return -1;
+		}
+		if(reactdiff_setup(r, MIN(600, size.w), MIN(600, size.h), 0, repr,
+		                   &reactdiff_presets[preset]) < 0)
+			return -1;
+	}
+	r->l = (size.w - r->w) / 2;
+	r->t = (size.h - r->h) / 2;
+	for(y = 0; y < size.h; y++)
+		for(x = 0; x < size.w; x++)
+			cgbp_set_pixel(c, x, y, 0x333333);
+	return 0;
+}
+
+// tile (tx, ty) changed by more than the threshold in the last step
+static inline int reactdiff_tile_active(const struct reactdiff *r, size_t tx,
+                                        size_t ty) {
+	return r->tile_active[ty % r->tiles_h * r->tiles_w + tx % r->tiles_w];
+}
+
+/* after a block: quiet tiles with quiet neighbours fall asleep, sleeping
+ * ones next to an active tile wake up. a tile falling asleep is copied into
+ * the other grid, so both hold it and the bands can leave it alone. */
+static inline void reactdiff_sleep(struct reactdiff *r) {
+	size_t tx, ty, i, y, x0, len, o, n = r->tiles_w * r->tiles_h;
+	int active;
+	for(ty = 0; ty < r->tiles_h; ty++)
+		for(tx = 0; tx < r->tiles_w; tx++) {
+			i = ty * r->tiles_w + tx;
+			active = 0;
+			for(y = 0; y < 9; y++)
+				active |= reactdiff_tile_active(r, tx + r->tiles_w - 1 + y % 3,
+				                                ty + r->tiles_h - 1 + y / 3);
+			r->tile_next[i] = !active;
+			if(r->tile_sleep[i]) {
+				r->tile_skipped += r->steps;
+				continue;
+			}
+			if(active)
+				continue;
+			x0 = tx * RD_TILE;
+			len = MIN(RD_TILE, r->w - x0) * r->repr->size;
+			for(y = ty * RD_TILE; y < MIN((ty + 1) * RD_TILE, r->h); y++) {
+				o = ((y + 1) * r->pitch + x0 + 1) * r->repr->size;
+				memcpy((uint8_t*)r->a[!r->cur] + o,
+				       (uint8_t*)r->a[r->cur] + o, len);
+				memcpy((uint8_t*)r->b[!r->cur] + o,
+				       (uint8_t*)r->b[r->cur] + o, len);
+			}
+		}
+	memcpy(r->tile_sleep, r->tile_next, n);
+	r->tile_steps += n * r->steps;
+}
+
+// with out set, the last step also draws the grid into it
+void reactdiff_step(struct reactdiff *r, size_t steps,
+                    const struct cgbp_fb *out) {
+	size_t done;
+	if(r->rkc_stages > 0) {
+		for(r->rkc_time += steps; r->rkc_time >= r->rkc_dt;
+		  r->rkc_time -= r->rkc_dt) {
+			r->steps = r->rkc_stages;
+			r->out = r->rkc_time < 2 * r->rkc_dt ? out : NULL;
+			cgbp_pool_run(&r->pool, r->num_bands, r->repr->rkc_band, r);
+			r->cur = !r->cur;
+		}
+		return;
+	}
+	for(done = 0; done < steps; done += r->steps) {
+		r->steps = MIN(r->block, steps - done);
+		r->out = done + r->steps == steps ? out : NULL;
+		cgbp_pool_run(&r->pool, r->num_bands, r->repr->band, r);
+		r->cur = !r->cur;
+		if(r->tile_sleep != NULL)
+			reactdiff_sleep(r);
 	}
 }
 
 int reactdiff_update(struct cgbp *c, void *data) {
 	struct reactdiff *r = data;
-	uint8_t i;
-	for(i = 0; i < STEPS_PER_FRAME; i++)
-		if(reactdiff_step(r) < 0)
-			return -1;
-	reactdiff_draw(c, r);
+	struct cgbp_fb fb = c->fb;
+	reactdiff_step(r, STEPS_PER_FRAME, &fb);
+	reactdiff_checkpoint_poll(r, 0);
+	if(r->snap_interval > 0 && cgbp_time() - r->snap_last >= r->snap_interval)
+		reactdiff_checkpoint(r);
 	return 0;
 }
 
 int reactdiff_action(struct cgbp *c, void *data, char r) {
 	if(r == 'q' || r == 'Q')
 		c->running = 0;
+	else if(r == 's' || r == 'S')
+		reactdiff_checkpoint(data);
 	return 0;
-	(void)data;
 }
 
 void reactdiff_cleanup(struct reactdiff *r) {
-	free(r->abmap);
+	reactdiff_checkpoint_poll(r, 1);
+	cgbp_pool_cleanup(&r->pool);
+	free(r->lines);
+	free(r->lut);
+	free(r->scratch);
+	free(r->snap_tmp);
+	free(r->tile_sleep);
+	free(r->tile_next);
+	free(r->tile_active);
+	if(r->map != NULL)
+		munmap(r->map, r->map_len);
+	else
+		free(r->mem);
+}
+
+#define RD_BENCH_FRAMES 16
+#define RD_BENCH_ACC_SIZE 256
+#define RD_BENCH_ACC_STEPS 512
+#define RD_BENCH_SLEEP_SIZE 512
+#define RD_BENCH_SLEEP_STEPS 4096
+
+// rkc_dt 0 steps with euler
+static inline double reactdiff_bench_run(struct reactdiff *r, size_t size,
+                                         size_t threads, size_t block,
+                                         const struct reactdiff_repr *repr,
+                                         const struct reactdiff_preset *p,
+                                         size_t steps, double rkc_dt) {
+	double start;
+	srand(1);
+	if((rkc_dt > 0 && reactdiff_rkc_init(r, rkc_dt) < 0) ||
+	  reactdiff_setup(r, size, size, threads, repr, p) < 0)
+		return -1;
+	r->block = block;
+	start = cgbp_time();
+	reactdiff_step(r, steps, NULL);
+	return (double)size * size * steps / (cgbp_time() - start) / 1e6;
+}
+
+// cell updates per second over grid size and thread count, sweeping the
+// grid once per step (block 1) or once per frame
+static inline int reactdiff_bench_threads(const struct reactdiff_repr *repr) {
+	static const size_t sizes[] = { 256, 600, 1024, 2048 };
+	static const size_t blocks[] = { 1, RD_BLOCK_STEPS };
+	struct reactdiff r;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t i, j, threads, max = cpus > 0 ? (size_t)cpus : 1;
+	double rate, base[2] = { 0, 0 };
+	char label[16];
+	snprintf(label, sizeof label, "block %d", RD_BLOCK_STEPS);
+	fprintf(stderr, "%s Mcell/s, speedup over one thread\n"
+	        "%6s %7s %20s %20s\n", repr->name, "size", "threads", "block 1",
+	        label);
+	for(i = 0; i < sizeof sizes / sizeof *sizes; i++)
+		for(threads = 1; threads <= max; threads =
+		  threads < max && threads * 2 > max ? max : threads * 2) {
+			fprintf(stderr, "%6zu %7zu", sizes[i], threads);
+			for(j = 0; j < 2; j++) {
+				r = (struct reactdiff){ .mem = NULL, };
+				rate = reactdiff_bench_run(&r, sizes[i], threads, blocks[j],
+				                           repr, &reactdiff_presets[
+				                           RD_DEFAULT_PRESET],
+				                           RD_BENCH_FRAMES * STEPS_PER_FRAME,
+				                           0);
+				reactdiff_cleanup(&r);
+				if(rate < 0)
+					return -1;
+				if(threads == 1)
+					base[j] = rate;
+				fprintf(stderr, " %11.1f (x%5.2f)", rate, rate / base[j]);
+			}
+			fprintf(stderr, "\n");
+		}
+	return 0;
+}
+
+// rms distance of a and b from ref, after making r the reference if asked
+static inline void reactdiff_bench_rms(const struct reactdiff *r, double *ref,
+                                       int is_ref, double err[2]) {
+	size_t n = r->w * r->h, x, y, o;
+	double d;
+	err[0] = err[1] = 0;
+	for(y = 0; y < r->h; y++)
+		for(x = 0; x < r->w; x++) {
+			o = (y + 1) * r->pitch + x + 1;
+			if(is_ref) {
+				ref[y * r->w + x] = r->repr->get(r->a[r->cur], o);
+				ref[n + y * r->w + x] = r->repr->get(r->b[r->cur], o);
+			}
+			d = r->repr->get(r->a[r->cur], o) - ref[y * r->w + x];
+			err[0] += d * d;
+			d = r->repr->get(r->b[r->cur], o) - ref[n + y * r->w + x];
+			err[1] += d * d;
+		}
+	err[0] = sqrt(err[0] / n);
+	err[1] = sqrt(err[1] / n);
+}
+
+/* throughput and rms distance from float64 after RD_BENCH_ACC_STEPS steps
+ * from the same start, per preset and representation */
+static inline int reactdiff_bench_reprs(void) {
+	struct reactdiff r;
+	const struct reactdiff_repr *repr;
+	size_t n = RD_BENCH_ACC_SIZE * RD_BENCH_ACC_SIZE, p, i;
+	double *ref = malloc(2 * n * sizeof *ref), rate, err[2];
+	if(ref == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	fprintf(stderr, "%zux%zu, %d steps\n%6s %6s %6s %8s %9s %9s %9s\n",
+	        (size_t)RD_BENCH_ACC_SIZE, (size_t)RD_BENCH_ACC_SIZE,
+	        RD_BENCH_ACC_STEPS, "preset", "feed", "kill", "repr", "Mcell/s",
+	        "rms a", "rms b");
+	for(p = 0; p < RD_NUM_PRESETS; p++)
+		// the reference goes last in reactdiff_reprs; run it first
+		for(i = 0; i < RD_NUM_REPRS; i++) {
+			repr = reactdiff_reprs[(i + RD_NUM_REPRS - 1) % RD_NUM_REPRS];
+			r = (struct reactdiff){ .mem = NULL, };
+			rate = reactdiff_bench_run(&r, RD_BENCH_ACC_SIZE, 0,
+			                           RD_BLOCK_STEPS, repr,
+			                           &reactdiff_presets[p],
+			                           RD_BENCH_ACC_STEPS, 0);
+			if(rate < 0) {
+				reactdiff_cleanup(&r);
+				free(ref);
+				return -1;
+			}
+			reactdiff_bench_rms(&r, ref, repr == &reactdiff_repr_float64, err);
+			reactdiff_cleanup(&r);
+			fprintf(stderr, "%6zu %6.4f %6.4f %8s %9.1f %9.2e %9.2e\n", p,
+			        reactdiff_presets[p].feed, reactdiff_presets[p].kill,
+			        repr->name, rate, err[0], err[1]);
+		}
+	free(ref);
+	return 0;
+}
+
+/* simulated time per second for float32 euler against rkc at growing dt,
+ * with the rms distance from float64 euler at the same simulated time */
+static inline int reactdiff_bench_rkc(void) {
+	static const double dts[] = { 0, 4, 8, 16, 32 };
+	static const size_t presets[] = { 0, RD_DEFAULT_PRESET };
+	struct reactdiff r;
+	size_t n = RD_BENCH_ACC_SIZE * RD_BENCH_ACC_SIZE, p, i;
+	double *ref = malloc(2 * n * sizeof *ref), rate, err[2];
+	if(ref == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	fprintf(stderr, "%zux%zu float32, %d time units\n"
+	        "%6s %10s %6s %6s %9s %9s %9s\n", (size_t)RD_BENCH_ACC_SIZE,
+	        (size_t)RD_BENCH_ACC_SIZE, RD_BENCH_ACC_STEPS, "preset",
+	        "integrator", "dt", "stages", "time/s", "rms a", "rms b");
+	for(p = 0; p < sizeof presets / sizeof *presets; p++)
+		// the float64 reference goes first
+		for(i = 0; i <= sizeof dts / sizeof *dts; i++) {
+			r = (struct reactdiff){ .mem = NULL, };
+			rate = reactdiff_bench_run(&r, RD_BENCH_ACC_SIZE, 0,
+			                           RD_BLOCK_STEPS, i == 0 ?
+			                           &reactdiff_repr_float64 :
+			                           &reactdiff_repr_float32,
+			                           &reactdiff_presets[presets[p]],
+			                           RD_BENCH_ACC_STEPS,
+			                           i == 0 ? 0 : dts[i - 1]);
+			if(rate < 0) {
+				reactdiff_cleanup(&r);
+				free(ref);
+				return -1;
+			}
+			reactdiff_bench_rms(&r, ref, i == 0, err);
+			if(i > 0)
+				fprintf(stderr, "%6zu %10s %6g %6zu %9.0f %9.2e %9.2e\n",
+				        presets[p], r.rkc_stages > 0 ? "rkc" : "euler",
+				        r.rkc_stages > 0 ? r.rkc_dt : 1.0,
+				        r.rkc_stages > 0 ? r.rkc_stages : 1,
+				        rate * 1e6 / n, err[0], err[1]);
+			reactdiff_cleanup(&r);
+		}
+	free(ref);
+	return 0;
+}
+
+/* effective cell updates per second with activity tracking at growing
+ * thresholds, the share of tile steps skipped, and the rms distance from
+ * the same run without tracking */
+static inline int reactdiff_bench_sleep(const struct reactdiff_repr *repr) {
+	static const double thresholds[] = { 0, 1e-5, 1e-4, 1e-3 };
+	static const size_t presets[] = { 0, 1, RD_DEFAULT_PRESET };
+	struct reactdiff r;
+	size_t n = RD_BENCH_SLEEP_SIZE * RD_BENCH_SLEEP_SIZE, p, i;
+	double *ref = malloc(2 * n * sizeof *ref), rate, base = 0, err[2];
+	if(ref == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	fprintf(stderr, "%zux%zu %s, %d steps\n%6s %9s %9s %8s %8s %9s %9s\n",
+	        (size_t)RD_BENCH_SLEEP_SIZE, (size_t)RD_BENCH_SLEEP_SIZE,
+	        repr->name, RD_BENCH_SLEEP_STEPS, "preset", "threshold",
+	        "Mcell/s", "skipped", "speedup", "rms a", "rms b");
+	for(p = 0; p < sizeof presets / sizeof *presets; p++)
+		for(i = 0; i < sizeof thresholds / sizeof *thresholds; i++) {
+			r = (struct reactdiff){ .mem = NULL, .sleep = thresholds[i], };
+			rate = reactdiff_bench_run(&r, RD_BENCH_SLEEP_SIZE, 0,
+			                           RD_BLOCK_STEPS, repr,
+			                           &reactdiff_presets[presets[p]],
+			                           RD_BENCH_SLEEP_STEPS, 0);
+			if(rate < 0) {
+				reactdiff_cleanup(&r);
+				free(ref);
+				return -1;
+			}
+			if(i == 0)
+				base = rate;
+			reactdiff_bench_rms(&r, ref, i == 0, err);
+			fprintf(stderr, "%6zu %9g %9.1f %7.1f%% %7.2fx %9.2e %9.2e\n",
+			        presets[p], thresholds[i], rate, r.tile_steps > 0 ?
+			        100. * r.tile_skipped / r.tile_steps : 0., rate / base,
+			        err[0], err[1]);
+			reactdiff_cleanup(&r);
+		}
+	free(ref);
+	return 0;
+}
+
+#define RD_SWEEP_SIZE 64
+#define RD_SWEEP_STEPS 4096
+// b above this counts as covered by pattern
+#define RD_SWEEP_COVER .1
+
+struct reactdiff_sweep_stats {
+	double feed, kill, mean_a, mean_b, sd_b, cover, change;
+	uint8_t ok;
+};
+
+/* a grid of small independent runs, kill across and feed down. each task
+ * is a whole run on a pool of one, so runs spread over the cores without
+ * any synchronization inside them; the last block draws the run's tile. */
+struct reactdiff_sweep {
+	const struct reactdiff_repr *repr;
+	struct cgbp_fb mosaic;
+	struct reactdiff_sweep_stats *stats;
+	double feed[2], kill[2], rkc_dt;
+	size_t num_feed, num_kill, size, steps, threads;
+};
+
+static inline double reactdiff_sweep_at(const double range[2], size_t i,
+                                        size_t n) {
+	return n > 1 ? range[0] + (range[1] - range[0]) * i / (n - 1) : range[0];
+}
+
+static inline void reactdiff_sweep_stats(const struct reactdiff *r,
+                                         struct reactdiff_sweep_stats *s) {
+	size_t n = r->w * r->h, x, y, o;
+	double a, b, sum_bb = 0, d, sum_dd = 0;
+	s->mean_a = s->mean_b = s->cover = 0;
+	for(y = 0; y < r->h; y++)
+		for(x = 0; x < r->w; x++) {
+			o = (y + 1) * r->pitch + x + 1;
+			a = r->repr->get(r->a[r->cur], o);
+			b = r->repr->get(r->b[r->cur], o);
+			// the other plane still holds the state before the last block
+			d = b - r->repr->get(r->b[!r->cur], o);
+			s->mean_a += a;
+			s->mean_b += b;
+			sum_bb += b * b;
+			sum_dd += d * d;
+			s->cover += b > RD_SWEEP_COVER;
+		}
+	s->mean_a /= n;
+	s->mean_b /= n;
+	s->sd_b = sqrt(MAX(sum_bb / n - s->mean_b * s->mean_b, 0));
+	s->cover /= n;
+	s->change = sqrt(sum_dd / n);
+}
+
+static void reactdiff_sweep_run(void *data, size_t task, size_t worker) {
+	struct reactdiff_sweep *sw = data;
+	struct reactdiff_sweep_stats *s = &sw->stats[task];
+	struct reactdiff r = { .mem = NULL, };
+	struct reactdiff_preset p = { 0, 0, 1, 0, sw->size / 4, 0 };
+	// long enough for a whole rkc step, which is what draws
+	size_t last = MIN(MAX(RD_BLOCK_STEPS, (size_t)ceil(sw->rkc_dt)),
+	                  sw->steps);
+	s->feed = p.feed = reactdiff_sweep_at(sw->feed, task / sw->num_kill,
+	                                      sw->num_feed);
+	s->kill = p.kill = reactdiff_sweep_at(sw->kill, task % sw->num_kill,
+	                                      sw->num_kill);
+	if((sw->rkc_dt > 0 && reactdiff_rkc_init(&r, sw->rkc_dt) < 0) ||
+	  reactdiff_setup(&r, sw->size, sw->size, 1, sw->repr, &p) < 0) {
+		reactdiff_cleanup(&r);
+		return;
+	}
+	r.l = task % sw->num_kill * sw->size;
+	r.t = task / sw->num_kill * sw->size;
+	reactdiff_step(&r, sw->steps - last, NULL);
+	reactdiff_step(&r, last, &sw->mosaic);
+	reactdiff_sweep_stats(&r, s);
+	s->ok = 1;
+	reactdiff_cleanup(&r);
+	(void)worker;
+}
+
+static inline int reactdiff_sweep_range(const char *name, double range[2],
+                                        size_t *n) {
+	const char *env = getenv(name);
+	if(env == NULL)
+		return 0;
+	if(sscanf(env, "%lf:%lf:%zu", &range[0], &range[1], n) != 3 || *n == 0) {
+		fprintf(stderr, "Error: %s: expected lo:hi:count.\n", name);
+		return -1;
+	}
+	return 0;
+}
+
+static inline int reactdiff_sweep_ppm(const struct cgbp_fb *fb,
+                                      const char *path) {
+	FILE *fp = fopen(path, "wb");
+	uint32_t color;
+	size_t x, y;
+	if(fp == NULL) {
+		perror(path);
+		return -1;
+	}
+	fprintf(fp, "P6\n%zu %zu\n255\n", fb->w, fb->h);
+	for(y = 0; y < fb->h; y++)
+		for(x = 0; x < fb->w; x++) {
+			color = cgbp_fb_get_pixel(fb, x, y);
+			putc(color >> 16 & 0xff, fp);
+			putc(color >> 8 & 0xff, fp);
+			putc(color & 0xff, fp);
+		}
+	if(fclose(fp) == EOF) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+/* run the grid of sw on a pool of threads into a fresh mosaic and stats,
+ * seconds taken or -1. every colour is opaque, so a run whose tile is
+ * left at zero alpha never drew and counts as failed. */
+static inline double reactdiff_sweep_grid(struct reactdiff_sweep *sw,
+                                          size_t threads) {
+	struct cgbp_pool pool;
+	size_t i, x, y, n = sw->num_feed * sw->num_kill, failed = 0;
+	double start, elapsed;
+	sw->mosaic.w = sw->num_kill * sw->size;
+	sw->mosaic.h = sw->num_feed * sw->size;
+	sw->mosaic.stride = sw->mosaic.w * sizeof(uint32_t);
+	sw->mosaic.data = calloc(sw->mosaic.h, sw->mosaic.stride);
+	sw->stats = calloc(n, sizeof *sw->stats);
+	if(sw->mosaic.data == NULL || sw->stats == NULL) {
+		perror("calloc");
+		return -1;
+	}
+	if(cgbp_pool_init(&pool, threads) < 0)
+		return -1;
+	sw->threads = pool.size;
+	start = cgbp_time();
+	cgbp_pool_run(&pool, n, reactdiff_sweep_run, sw);
+	elapsed = cgbp_time() - start;
+	cgbp_pool_cleanup(&pool);
+	for(i = 0; i < n; i++) {
+		x = i % sw->num_kill * sw->size;
+		y = i / sw->num_kill * sw->size;
+		if(((uint32_t*)cgbp_fb_row(&sw->mosaic, y))[x] >> 24 == 0)
+			sw->stats[i].ok = 0;
+		failed += !sw->stats[i].ok;
+	}
+	if(failed > 0) {
+		fprintf(stderr, "Error: %zu runs failed.\n", failed);
+		return -1;
+	}
+	return elapsed;
+}
+
+/* REACTDIFF_SWEEP=file.ppm: run REACTDIFF_SWEEP_FEED by REACTDIFF_SWEEP_KILL
+ * (lo:hi:count) small grids, write their final states as a mosaic and
+ * per-run statistics to stdout */
+int reactdiff_sweep(const char *path) {
+	struct reactdiff_sweep sw = {
+		NULL, { NULL, NULL, 0, 0, 0, CGBP_FORMAT_XRGB8888 }, NULL,
+		{ .01, .09 }, { .045, .07 }, 0, 16, 16, RD_SWEEP_SIZE, RD_SWEEP_STEPS,
+		0,
+	};
+	const char *env = getenv("REACTDIFF_REPR");
+	size_t i, n;
+	double elapsed;
+	int ret = -1;
+	if(cgbp_kernels_init() < 0 ||
+	  (sw.repr = reactdiff_find_repr(env != NULL ? env :
+	                                 RD_DEFAULT_REPR)) == NULL ||
+	  reactdiff_sweep_range("REACTDIFF_SWEEP_FEED", sw.feed, &sw.num_feed) < 0 ||
+	  reactdiff_sweep_range("REACTDIFF_SWEEP_KILL", sw.kill, &sw.num_kill) < 0)
+		return -1;
+	if((env = getenv("REACTDIFF_SWEEP_SIZE")) != NULL)
+		sw.size = strtoul(env, NULL, 10);
+	if((env = getenv("REACTDIFF_SWEEP_STEPS")) != NULL)
+		sw.steps = strtoul(env, NULL, 10);
+	if((env = getenv("REACTDIFF_RKC")) != NULL)
+		sw.rkc_dt = strtod(env, NULL);
+	if(sw.size < 8 || sw.steps == 0) {
+		fprintf(stderr, "Error: REACTDIFF_SWEEP: expected a size of at least "
+		        "8 and some steps.\n");
+		return -1;
+	}
+	if(env != NULL && sw.rkc_dt <= 0) {
+		fprintf(stderr, "Error: REACTDIFF_RKC: expected a positive dt.\n");
+		return -1;
+	}
+	if(sw.rkc_dt > 0 && sw.repr->rkc_band == NULL) {
+		fprintf(stderr, "Error: REACTDIFF_RKC: %s cells have no rkc "
+		        "stepper.\n", sw.repr->name);
+		return -1;
+	}
+	if(sw.steps < sw.rkc_dt) {
+		fprintf(stderr, "Error: REACTDIFF_SWEEP_STEPS: expected at least "
+		        "one rkc step.\n");
+		return -1;
+	}
+	n = sw.num_feed * sw.num_kill;
+	if((elapsed = reactdiff_sweep_grid(&sw, 0)) < 0)
+		goto error;
+	printf("feed\tkill\tmean_a\tmean_b\tsd_b\tcover\tchange\n");
+	for(i = 0; i < n; i++)
+		printf("%.5f\t%.5f\t%.4f\t%.4f\t%.4f\t%.4f\t%.3e\n",
+		       sw.stats[i].feed, sw.stats[i].kill, sw.stats[i].mean_a,
+		       sw.stats[i].mean_b, sw.stats[i].sd_b, sw.stats[i].cover,
+		       sw.stats[i].change);
+	fprintf(stderr, "%zu runs of %zux%zu %s, %zu steps, %zu threads: "
+	        "%.2f s, %.1f runs/s, %.1f Mcell/s\n", n, sw.size, sw.size,
+	        sw.repr->name, sw.steps, sw.threads, elapsed, n / elapsed,
+	        (double)n * sw.size * sw.size * sw.steps / elapsed / 1e6);
+	if(reactdiff_sweep_ppm(&sw.mosaic, path) == 0)
+		ret = 0;
+error:
+	free(sw.mosaic.data);
+	free(sw.stats);
+	return ret;
+}
+
+/* a small sweep with rkc steps of two and a half blocks, where the time
+ * left over before the last block and the block itself fall short of a
+ * stage: every run still has to draw its tile */
+static inline int reactdiff_bench_sweep(void) {
+	struct reactdiff_sweep sw = {
+		&reactdiff_repr_float32,
+		{ NULL, NULL, 0, 0, 0, CGBP_FORMAT_XRGB8888 }, NULL,
+		{ .01, .09 }, { .045, .07 }, RD_BLOCK_STEPS * 2.5, 4, 4, 16,
+		RD_SWEEP_STEPS, 0,
+	};
+	double elapsed = reactdiff_sweep_grid(&sw, 0);
+	free(sw.mosaic.data);
+	free(sw.stats);
+	if(elapsed < 0)
+		return -1;
+	fprintf(stderr, "sweep, rkc dt %g: all %zu tiles drawn\n", sw.rkc_dt,
+	        sw.num_feed * sw.num_kill);
+	return 0;
+}
+
+/* CGBP_BENCH: thread scaling for REACTDIFF_REPR, every representation
+ * against every preset, the rkc integrator against euler, then activity
+ * tracking and a sweep with long rkc steps */
+int reactdiff_bench(void) {
+	const struct reactdiff_repr *repr;
+	const char *env = getenv("REACTDIFF_REPR");
+	if(cgbp_kernels_init() < 0)
+		return -1;
+	repr = reactdiff_find_repr(env != NULL ? env : RD_DEFAULT_REPR);
+	if(repr == NULL || reactdiff_bench_threads(repr) < 0 ||
+	  reactdiff_bench_reprs() < 0 || reactdiff_bench_rkc() < 0)
+		return -1;
+	if(reactdiff_bench_sleep(repr) < 0)
+		return -1;
+	return reactdiff_bench_sweep();
 }
 
 int main(void) {
 	struct cgbp c;
-	struct reactdiff r = { .abmap = NULL, };
+	struct reactdiff r = { .mem = NULL, };
 	int ret = EXIT_FAILURE;
+	const char *sweep = getenv("REACTDIFF_SWEEP");
 	srand(time(NULL));
+	if(sweep != NULL)
+		return reactdiff_sweep(sweep) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+	if(getenv("CGBP_BENCH") != NULL)
+		return reactdiff_bench() < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 	if(cgbp_init(&c) < 0 || reactdiff_init(&c, &r) < 0)
 		goto error;
 	if(cgbp_main(&c, &r,
 	  (struct cgbp_callbacks){ reactdiff_update, reactdiff_action }) == 0)
 		ret = EXIT_SUCCESS;
+	if(r.tile_steps > 0)
+		fprintf(stderr, "skipped %.1f%% of tile steps\n",
+		        100. * r.tile_skipped / r.tile_steps);
+	if(r.snap_path != NULL) {
+		reactdiff_checkpoint_poll(&r, 1);
+		if(reactdiff_snapshot(&r) < 0)
+			ret = EXIT_FAILURE;
+	}
 error:
 	cgbp_cleanup(&c);
 	reactdiff_cleanup(&r);
@@ -0,0 +1,352 @@
+/* reactdiff_repr.h
+ *
+ * Copyright (c) 2018, mar77i <mar77i at protonmail dot ch>
+ *
+ * This software may be modified and distributed under the terms
+ * of the ISC license.  See the LICENSE file for details.
+ */
+
+/* the reactdiff stepper for one cell representation. reactdiff.c includes
+ * this once per representation, after defining:
+ *
+ *	RD_NAME             suffix for the generated names
+ *	RD_T                storage type of a cell
+ *	RD_W                type the stencil computes in
+ *	RD_UNIT, RD_MAX     the value standing for 1, and the largest one kept
+ *	RD_MIN              the smallest one kept, anything below becomes 0
+ *	RD_MULU(a, b)       a * b / RD_UNIT for 0 <= a, b <= RD_UNIT
+ *	RD_MULS(a, b)       the same for negative b
+ *	RD_DIV(x, d)        x / d for the laplacian weights
+ *	RD_LUT_BINS         colour table bins per axis
+ *	RD_LUT_INDEX(x)     the bin of a cell value
+ *	RD_FLOAT            if defined, also generate the RKC stepper
+ *
+ * and defines reactdiff_repr_<RD_NAME>. */
+
+#define RD_CAT_(a, b) a##_##b
+#define RD_CAT(a, b) RD_CAT_(a, b)
+#define RD_FN(name) RD_CAT(name, RD_NAME)
+#define RD_STR_(x) #x
+#define RD_STR(x) RD_STR_(x)
+// expand RD_FN before CGBP_KERNEL pastes onto the name
+#define RD_KERNEL(name, params, args) CGBP_KERNEL(name, params, args)
+
+// fill the ghost columns of rows [y0, y1) from the opposite edge
+static inline void RD_FN(reactdiff_wrap)(const struct reactdiff *r, RD_T *p,
+                                         size_t y0, size_t y1) {
+	RD_T *row;
+	for(; y0 < y1; y0++) {
+		row = p + y0 * r->pitch;
+		row[0] = row[r->w];
+		row[r->w + 1] = row[1];
+	}
+}
+
+static inline void RD_FN(reactdiff_cell)(RD_T *na, RD_T *nb, RD_W a, RD_W b,
+                                         RD_W lap_a, RD_W lap_b, RD_W da,
+                                         RD_W db, RD_W feed, RD_W kill) {
+	RD_W abb = RD_MULU(a, RD_MULU(b, b));
+	a += RD_MULS(da, lap_a) - abb + RD_MULU(feed, RD_UNIT - a);
+	b += RD_MULS(db, lap_b) + abb - RD_MULU(kill + feed, b);
+	*na = a < RD_MIN ? 0 : a > RD_MAX ? RD_MAX : a;
+	*nb = b < RD_MIN ? 0 : b > RD_MAX ? RD_MAX : b;
+}
+
+#define RD_LAPLACE(up, cur, down, right, x) ( \
+	+ RD_DIV((RD_W)(up)[(x) - 1] + (up)[(x) + 1] + \
+	         (down)[(x) - 1] + (down)[(x) + 1], 20) \
+	+ RD_DIV((RD_W)(up)[x] + (cur)[(x) - 1] + (right) + (down)[x], 5) \
+	- (cur)[x] \
+)
+
+/* cells [x0, x1) of a row of planes a and b into na and nb. the last cell
+ * wraps around to the already updated first one, as it did when rows were
+ * updated in place; keep it that way so results stay the same. */
+RD_KERNEL(RD_FN(reactdiff_row), (const struct reactdiff *r,
+                                 RD_T *restrict na, RD_T *restrict nb,
+                                 const RD_T *restrict a,
+                                 const RD_T *restrict b, size_t x0,
+                                 size_t x1),
+          (r, na, nb, a, b, x0, x1)) {
+	const RD_T *ua = a - r->pitch, *da = a + r->pitch,
+	           *ub = b - r->pitch, *db = b + r->pitch;
+	RD_W diff_a = r->da * RD_UNIT, diff_b = r->db * RD_UNIT,
+	     feed = r->feed * RD_UNIT, kill = r->kill * RD_UNIT;
+	size_t x, lc = r->w - 1;
+	for(x = x0; x < MIN(x1, lc); x++)
+		RD_FN(reactdiff_cell)(&na[x], &nb[x], a[x], b[x],
+		                      RD_LAPLACE(ua, a, da, a[x + 1], x),
+		                      RD_LAPLACE(ub, b, db, b[x + 1], x),
+		                      diff_a, diff_b, feed, kill);
+	if(x1 > lc)
+		RD_FN(reactdiff_cell)(&na[lc], &nb[lc], a[lc], b[lc],
+		                      RD_LAPLACE(ua, a, da, na[0], lc),
+		                      RD_LAPLACE(ub, b, db, nb[0], lc),
+		                      diff_a, diff_b, feed, kill);
+}
+
+// whether a or b moved by more than t from their old values oa and ob
+RD_KERNEL(RD_FN(reactdiff_change_row), (uint8_t *changed,
+                                        const RD_T *restrict a,
+                                        const RD_T *restrict b,
+                                        const RD_T *restrict oa,
+                                        const RD_T *restrict ob, size_t n,
+                                        RD_W t),
+          (changed, a, b, oa, ob, n, t)) {
+	RD_W da, db;
+	size_t x;
+	int c = 0;
+	for(x = 0; x < n; x++) {
+		da = a[x] > oa[x] ? (RD_W)a[x] - oa[x] : (RD_W)oa[x] - a[x];
+		db = b[x] > ob[x] ? (RD_W)b[x] - ob[x] : (RD_W)ob[x] - b[x];
+		c |= (da > t) | (db > t);
+	}
+	*changed |= c;
+}
+
+/* grid row y's cells in awake tiles; with track set this is the block's
+ * last step, so also note which awake tiles changed in it */
+static inline void RD_FN(reactdiff_tiles)(const struct reactdiff *r,
+                                          RD_T *na, RD_T *nb, const RD_T *a,
+                                          const RD_T *b, size_t y,
+                                          int track) {
+	const uint8_t *sleep;
+	uint8_t *active;
+	size_t t0, t1;
+	if(r->tile_sleep == NULL) {
+		RD_FN(reactdiff_row)(r, na, nb, a, b, 0, r->w);
+		return;
+	}
+	sleep = r->tile_sleep + y / RD_TILE * r->tiles_w;
+	active = r->tile_active + y / RD_TILE * r->tiles_w;
+	for(t0 = 0; t0 < r->tiles_w; t0 = t1) {
+		for(; t0 < r->tiles_w && sleep[t0]; t0++);
+		for(t1 = t0; t1 < r->tiles_w && !sleep[t1]; t1++);
+		if(t0 < t1)
+			RD_FN(reactdiff_row)(r, na, nb, a, b, t0 * RD_TILE,
+			                     MIN(t1 * RD_TILE, r->w));
+	}
+	if(!track)
+		return;
+	for(t0 = 0; t0 < r->tiles_w; t0++) {
+		if(sleep[t0])
+			continue;
+		t1 = t0 * RD_TILE;
+		RD_FN(reactdiff_change_row)(&active[t0], na + t1, nb + t1, a + t1,
+		                            b + t1, MIN(RD_TILE, r->w - t1),
+		                            r->sleep * RD_UNIT);
+	}
+}
+
+RD_KERNEL(RD_FN(reactdiff_colorify_row), (uint32_t *restrict out,
+                                          const RD_T *a, const RD_T *b,
+                                          const uint32_t *lut, size_t w),
+          (out, a, b, lut, w)) {
+	size_t x;
+	for(x = 0; x < w; x++)
+		out[x] = lut[RD_LUT_INDEX(a[x]) * RD_LUT_BINS + RD_LUT_INDEX(b[x])];
+}
+
+// colour grid row y while it is still in cache
+static inline void RD_FN(reactdiff_emit)(const struct reactdiff *r,
+                                         size_t worker, const RD_T *a,
+                                         const RD_T *b, size_t y) {
+	struct cgbp_fb fb = *r->out;
+	uint32_t *line = r->lines + worker * r->w;
+	size_t x;
+	switch(CGBP_FB_FORMAT(&fb)) {
+	case CGBP_FORMAT_XRGB8888:
+	case CGBP_FORMAT_ARGB8888:
+		RD_FN(reactdiff_colorify_row)(
+			(uint32_t*)cgbp_fb_row(&fb, r->t + y) + r->l, a, b, r->lut, r->w);
+		return;
+	default:
+		RD_FN(reactdiff_colorify_row)(line, a, b, r->lut, r->w);
+		for(x = 0; x < r->w; x++)
+			cgbp_fb_set_pixel(&fb, r->l + x, r->t + y, line[x]);
+		return;
+	}
+}
+
+/* take r->steps steps on one band. scratch row j holds grid row
+ * y0 + j - steps, wrapped around; after step s only rows [s + 1, n - s - 1)
+ * are still exact, and the last step lands on the band itself. sleeping
+ * tiles hold still, so they are loaded into both scratch sets. */
+static void RD_FN(reactdiff_band)(void *data, size_t band, size_t worker) {
+	struct reactdiff *r = data;
+	size_t k = r->steps, y0 = band * r->band_h,
+	       n = MIN(r->band_h, r->h - y0) + 2 * k,
+	       plane = r->scratch_len / RD_SCRATCH_PLANES, j, s, y, o;
+	RD_T *a = r->a[r->cur], *b = r->b[r->cur],
+	     *ga = r->a[!r->cur], *gb = r->b[!r->cur], *sa[2], *sb[2], *na, *nb;
+	sa[0] = (RD_T*)r->scratch + worker * r->scratch_len;
+	sb[0] = sa[0] + plane;
+	sa[1] = sb[0] + plane;
+	sb[1] = sa[1] + plane;
+	for(j = 0; j < n; j++) {
+		y = (y0 + j + (r->h - k % r->h)) % r->h;
+		for(s = 0; s < (k > 1 && r->tile_sleep != NULL &&
+		  memchr(r->tile_sleep + y / RD_TILE * r->tiles_w, 1,
+		         r->tiles_w) != NULL ? 2 : 1); s++) {
+			memcpy(sa[s] + j * r->pitch + 1, &RD_AT(r, a, 0, y),
+			       r->w * sizeof *a);
+			memcpy(sb[s] + j * r->pitch + 1, &RD_AT(r, b, 0, y),
+			       r->w * sizeof *b);
+		}
+	}
+	if(r->tile_sleep != NULL)
+		memset(r->tile_active + y0 / RD_TILE * r->tiles_w, 0,
+		       (n - 2 * k + RD_TILE - 1) / RD_TILE * r->tiles_w);
+	RD_FN(reactdiff_wrap)(r, sa[0], 0, n);
+	RD_FN(reactdiff_wrap)(r, sb[0], 0, n);
+	for(s = 0; s < k; s++) {
+		for(j = s + 1; j < n - s - 1; j++) {
+			o = j * r->pitch + 1;
+			y = (y0 + j + (r->h - k % r->h)) % r->h;
+			if(s + 1 < k) {
+				na = sa[!(s & 1)] + o;
+				nb = sb[!(s & 1)] + o;
+			} else {
+				na = &RD_AT(r, ga, 0, y);
+				nb = &RD_AT(r, gb, 0, y);
+			}
+			RD_FN(reactdiff_tiles)(r, na, nb, sa[s & 1] + o, sb[s & 1] + o, y,
+			                       s + 1 == k);
+			if(s + 1 == k && r->out != NULL)
+				RD_FN(reactdiff_emit)(r, worker, na, nb, y0 + j - k);
+		}
+		if(s + 1 < k) {
+			RD_FN(reactdiff_wrap)(r, sa[!(s & 1)], s + 1, n - s - 1);
+			RD_FN(reactdiff_wrap)(r, sb[!(s & 1)], s + 1, n - s - 1);
+		}
+	}
+}
+
+#ifdef RD_FLOAT
+/* stage j of a damped first order Runge-Kutta-Chebyshev step:
+ * y_j = mu_j y_j-1 + nu_j y_j-2 + mut_j f(y_j-1). the ghost cells make the
+ * grid a plain torus here; only the last stage clamps. */
+RD_KERNEL(RD_FN(reactdiff_rkc_row), (const struct reactdiff *r, size_t j,
+                                     RD_T *restrict na, RD_T *restrict nb,
+                                     const RD_T *restrict a,
+                                     const RD_T *restrict b,
+                                     const RD_T *restrict pa,
+                                     const RD_T *restrict pb),
+          (r, j, na, nb, a, b, pa, pb)) {
+	const RD_T *ua = a - r->pitch, *da = a + r->pitch,
+	           *ub = b - r->pitch, *db = b + r->pitch;
+	RD_W diff_a = r->da, diff_b = r->db, feed = r->feed, kill = r->kill,
+	     mu = r->rkc_mu[j], nu = r->rkc_nu[j], mut = r->rkc_mut[j], abb,
+	     fa, fb, va, vb;
+	size_t x;
+	int last = j == r->rkc_stages;
+	for(x = 0; x < r->w; x++) {
+		abb = a[x] * b[x] * b[x];
+		fa = diff_a * RD_LAPLACE(ua, a, da, a[x + 1], x) - abb +
+		     feed * (1 - a[x]);
+		fb = diff_b * RD_LAPLACE(ub, b, db, b[x + 1], x) + abb -
+		     (kill + feed) * b[x];
+		va = mu * a[x] + nu * pa[x] + mut * fa;
+		vb = mu * b[x] + nu * pb[x] + mut * fb;
+		if(last) {
+			va = va < RD_MIN ? 0 : va > RD_MAX ? RD_MAX : va;
+			vb = vb < RD_MIN ? 0 : vb > RD_MAX ? RD_MAX : vb;
+		}
+		na[x] = va;
+		nb[x] = vb;
+	}
+}
+
+/* one rkc step of r->rkc_stages stages on a band, blocked like
+ * reactdiff_band; stages rotate through three scratch sets */
+static void RD_FN(reactdiff_rkc_band)(void *data, size_t band,
+                                      size_t worker) {
+	struct reactdiff *r = data;
+	size_t k = r->steps, y0 = band * r->band_h,
+	       n = MIN(r->band_h, r->h - y0) + 2 * k,
+	       plane = r->scratch_len / RD_SCRATCH_PLANES, i, j, y, o, cur, prev;
+	RD_T *a = r->a[r->cur], *b = r->b[r->cur],
+	     *ga = r->a[!r->cur], *gb = r->b[!r->cur], *sa[3], *sb[3], *na, *nb;
+	for(i = 0; i < 3; i++) {
+		sa[i] = (RD_T*)r->scratch + worker * r->scratch_len + 2 * i * plane;
+		sb[i] = sa[i] + plane;
+	}
+	for(i = 0; i < n; i++) {
+		y = (y0 + i + (r->h - k % r->h)) % r->h;
+		memcpy(sa[0] + i * r->pitch + 1, &RD_AT(r, a, 0, y),
+		       r->w * sizeof *a);
+		memcpy(sb[0] + i * r->pitch + 1, &RD_AT(r, b, 0, y),
+		       r->w * sizeof *b);
+	}
+	RD_FN(reactdiff_wrap)(r, sa[0], 0, n);
+	RD_FN(reactdiff_wrap)(r, sb[0], 0, n);
+	for(j = 1; j <= k; j++) {
+		cur = (j - 1) % 3;
+		// nu_1 is 0; any readable set will do
+		prev = j > 1 ? (j - 2) % 3 : cur;
+		for(i = j; i < n - j; i++) {
+			o = i * r->pitch + 1;
+			if(j < k) {
+				na = sa[j % 3] + o;
+				nb = sb[j % 3] + o;
+			} else {
+				na = &RD_AT(r, ga, 0, y0 + i - k);
+				nb = &RD_AT(r, gb, 0, y0 + i - k);
+			}
+			RD_FN(reactdiff_rkc_row)(r, j, na, nb, sa[cur] + o, sb[cur] + o,
+			                         sa[prev] + o, sb[prev] + o);
+			if(j == k && r->out != NULL)
+				RD_FN(reactdiff_emit)(r, worker, na, nb, y0 + i - k);
+		}
+		if(j < k) {
+			RD_FN(reactdiff_wrap)(r, sa[j % 3], j, n - j);
+			RD_FN(reactdiff_wrap)(r, sb[j % 3], j, n - j);
+		}
+	}
+}
+#define RD_RKC_BAND RD_FN(reactdiff_rkc_band)
+#else
+#define RD_RKC_BAND NULL
+#endif
+
+// v is in units of RD_UNIT
+static void RD_FN(reactdiff_set)(void *plane, size_t i, double v) {
+	((RD_T*)plane)[i] = v < RD_MIN ? 0 : v > RD_MAX ? RD_MAX : v;
+}
+
+// as a fraction of RD_UNIT
+static double RD_FN(reactdiff_get)(const void *plane, size_t i) {
+	return (double)((const RD_T*)plane)[i] / RD_UNIT;
+}
+
+static const struct reactdiff_repr RD_FN(reactdiff_repr) = {
+	RD_STR(RD_NAME),
+	sizeof(RD_T),
+	RD_LUT_BINS,
+	(double)RD_UNIT,
+	RD_FN(reactdiff_band),
+	RD_RKC_BAND,
+	RD_FN(reactdiff_set),
+	RD_FN(reactdiff_get),
+};
+
+#undef RD_CAT_
+#undef RD_CAT
+#undef RD_FN
+#undef RD_STR_
+#undef RD_STR
+#undef RD_KERNEL
+#undef RD_LAPLACE
+#undef RD_NAME
+#undef RD_T
+#undef RD_W
+#undef RD_UNIT
+#undef RD_MAX
+#undef RD_MIN
+#undef RD_MULU
+#undef RD_MULS
+#undef RD_DIV
+#undef RD_LUT_BINS
+#undef RD_LUT_INDEX
+#undef RD_FLOAT
+#undef RD_RKC_BAND
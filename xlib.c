@@ -11,8 +11,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
 
 #include "cgbp.h"
 
@@ -28,10 +31,19 @@ struct xlib {
 	XImage *img;
 	XIM xim;
 	XIC xic;
+	XShmSegmentInfo shm;
 	size_t img_allo;
-	uint8_t cmap_set: 1, win_set: 1, gc_set: 1;
+	uint8_t cmap_set: 1, win_set: 1, gc_set: 1, use_shm: 1, shm_set: 1;
 };
 
+static int xlib_shm_failed = 0;
+static int xlib_shm_error(Display *disp, XErrorEvent *ev) {
+	xlib_shm_failed = 1;
+	return 0;
+	(void)disp;
+	(void)ev;
+}
+
 static inline int setup_input(struct xlib *x) {
 	x->xim = XOpenIM(x->disp, NULL, NULL, NULL);
 	if(x->xim != NULL)
@@ -71,9 +83,54 @@ void invisible_cursor(struct xlib *x) {
 	XFreePixmap(x->disp, p);
 }
 
+// back the image by a shared memory segment the server can read directly
+static inline int setup_shm(struct xlib *x, XWindowAttributes *attr) {
+	XErrorHandler old_handler;
+	if(XShmQueryExtension(x->disp) == False) {
+		fprintf(stderr, "Error: MIT-SHM extension not available.\n");
+		return -1;
+	}
+	x->img = XShmCreateImage(x->disp, x->vinfo.visual, x->vinfo.depth,
+	                         ZPixmap, NULL, &x->shm, attr->width, attr->height);
+	if(x->img == NULL) {
+		fprintf(stderr, "Error: XShmCreateImage failed.\n");
+		return -1;
+	}
+	x->shm.shmid = shmget(IPC_PRIVATE, x->img->bytes_per_line * x->img->height,
+	                      IPC_CREAT|0600);
+	if(x->shm.shmid < 0) {
+		perror("shmget");
+		return -1;
+	}
+	x->shm.shmaddr = x->img->data = shmat(x->shm.shmid, NULL, 0);
+	if(x->shm.shmaddr == (void*)-1) {
+		perror("shmat");
+		x->img->data = NULL;
+		shmctl(x->shm.shmid, IPC_RMID, NULL);
+		return -1;
+	}
+	x->shm.readOnly = False;
+	// attaching fails asynchronously, e.g. for a remote display
+	xlib_shm_failed = 0;
+	old_handler = XSetErrorHandler(xlib_shm_error);
+	XShmAttach(x->disp, &x->shm);
+	XSync(x->disp, False);
+	XSetErrorHandler(old_handler);
+	// the segment goes away once both sides have detached
+	shmctl(x->shm.shmid, IPC_RMID, NULL);
+	if(xlib_shm_failed) {
+		fprintf(stderr, "Error: XShmAttach failed.\n");
+		shmdt(x->shm.shmaddr);
+		x->img->data = NULL;
+		return -1;
+	}
+	x->shm_set = 1;
+	return 0;
+}
+
 void xlib_cleanup(struct cgbp *c);
 
-int xlib_init(struct cgbp *c) {
+static inline int xlib_init_common(struct cgbp *c, uint8_t use_shm) {
 	struct xlib *x = malloc(sizeof *x);
 	Window root;
 	XWindowAttributes attr;
@@ -86,6 +143,8 @@ int xlib_init(struct cgbp *c) {
 	x->cmap_set = 0;
 	x->win_set = 0;
 	x->gc_set = 0;
+	x->use_shm = use_shm;
+	x->shm_set = 0;
 	x->xic = NULL;
 	x->xim = NULL;
 	x->img = NULL;
@@ -129,22 +188,36 @@ int xlib_init(struct cgbp *c) {
 	XMoveResizeWindow(x->disp, x->win, 0, 0, attr.width, attr.height);
 	XRaiseWindow(x->disp, x->win);
 
-	x->img = XCreateImage(
-		x->disp, x->vinfo.visual, x->vinfo.depth, ZPixmap, 0, NULL,
-		attr.width, attr.height, 8, 0
-	);
-	if(x->img == NULL) {
-		fprintf(stderr, "Error: XCreateImage failed.\n");
-		goto error;
-	}
-	bytesize = x->img->depth / CHAR_BIT * x->img->width * x->img->height;
-	x->img->data = malloc(bytesize);
-	if(x->img->data == NULL) {
-		perror("malloc");
-		goto error;
+	if(x->use_shm) {
+		if(setup_shm(x, &attr) < 0)
+			goto error;
+		bytesize = x->img->bytes_per_line * x->img->height;
+	} else {
+		x->img = XCreateImage(
+			x->disp, x->vinfo.visual, x->vinfo.depth, ZPixmap, 0, NULL,
+			attr.width, attr.height, 8, 0
+		);
+		if(x->img == NULL) {
+			fprintf(stderr, "Error: XCreateImage failed.\n");
+			goto error;
+		}
+		bytesize = x->img->depth / CHAR_BIT * x->img->width * x->img->height;
+		x->img->data = malloc(bytesize);
+		if(x->img->data == NULL) {
+			perror("malloc");
+			goto error;
+		}
 	}
 	for(i = 0; i < bytesize; i++)
 		x->img->data[i] = i % (x->img->depth / CHAR_BIT) > 2 ? 255 : 0;
+	c->fb.data = (uint8_t*)x->img->data;
+	c->fb.w = x->img->width;
+	c->fb.h = x->img->height;
+	c->fb.stride = x->img->bytes_per_line;
+	if(x->img->bits_per_pixel == 32 && x->img->byte_order == LSBFirst &&
+	  x->vinfo.red_mask == 0xff0000 && x->vinfo.green_mask == 0xff00 &&
+	  x->vinfo.blue_mask == 0xff)
+		c->fb.format = CGBP_FORMAT_ARGB8888;
 	if(setup_input(x) < 0)
 		goto error;
 	invisible_cursor(x);
@@ -154,6 +227,14 @@ error:
 	return -1;
 }
 
+int xlib_init(struct cgbp *c) {
+	return xlib_init_common(c, 0);
+}
+
+int xlib_shm_init(struct cgbp *c) {
+	return xlib_init_common(c, 1);
+}
+
 static inline int handle_events(struct cgbp *c, void *cb_data, XEvent *ev,
                                 struct cgbp_callbacks cb) {
 	struct xlib *x = c->driver_data;
@@ -191,8 +272,14 @@ int xlib_update(struct cgbp *c, void *cb_data, struct cgbp_callbacks cb) {
 	}
 	if(cb.update != NULL && cb.update(c, cb_data) < 0)
 		return -1;
-	XPutImage(x->disp, x->win, x->gc, x->img,
-	          0, 0, 0, 0, x->img->width, x->img->height);
+	if(x->use_shm) {
+		XShmPutImage(x->disp, x->win, x->gc, x->img,
+		             0, 0, 0, 0, x->img->width, x->img->height, False);
+		// the server reads our memory; don't draw over it before it's done
+		XSync(x->disp, False);
+	} else
+		XPutImage(x->disp, x->win, x->gc, x->img,
+		          0, 0, 0, 0, x->img->width, x->img->height);
 	return 0;
 }
 
@@ -202,8 +289,15 @@ void xlib_cleanup(struct cgbp *c) {
 		XDestroyIC(x->xic);
 	if(x->xim != NULL)
 		XCloseIM(x->xim);
-	if(x->img != NULL)
+	if(x->shm_set) {
+		XShmDetach(x->disp, &x->shm);
+		shmdt(x->shm.shmaddr);
+	}
+	if(x->img != NULL) {
+		if(x->use_shm)
+			x->img->data = NULL;
 		XDestroyImage(x->img);
+	}
 	if(x->cmap_set == 1)
 		XFreeColormap(x->disp, x->cmap);
 	if(x->gc_set)
@@ -241,11 +335,24 @@ struct cgbp_size xlib_size(struct cgbp *c) {
 	return (struct cgbp_size){ x->img->width, x->img->height };
 }
 
-struct cgbp_driver driver = {
+struct cgbp_driver xlib_driver = {
+	"xlib",
 	xlib_init,
 	xlib_update,
 	xlib_cleanup,
 	xlib_get_pixel,
 	xlib_set_pixel,
 	xlib_size,
+	NULL,
+};
+
+struct cgbp_driver xlib_shm_driver = {
+	"xshm",
+	xlib_shm_init,
+	xlib_update,
+	xlib_cleanup,
+	xlib_get_pixel,
+	xlib_set_pixel,
+	xlib_size,
+	NULL,
 };